@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libsoftefac.h"
+
+#define COUNT 10000000
+#define ROUNDS 10
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int run(const char *name, const float *vals) {
+  int i, r;
+  double dsum = 0;
+  float exact = 0, adaptive = 0;
+  double t_double, t_efac, t_adaptive;
+  t_double = now();
+  for (r = 0; r < ROUNDS; r++)
+    for (i = 0; i < COUNT; i++)
+      dsum += vals[i];
+  t_double = now() - t_double;
+  t_efac = now();
+  for (r = 0; r < ROUNDS; r++) {
+    efac_clear(0);
+    efac_add_array(0, vals, COUNT);
+    exact = efac_read_round_nearest(0);
+  }
+  t_efac = now() - t_efac;
+  t_adaptive = now();
+  for (r = 0; r < ROUNDS; r++)
+    adaptive = efac_sum_adaptive(vals, COUNT);
+  t_adaptive = now() - t_adaptive;
+  printf("%-10s double %.9e %.2f ns, efac %.9e %.2f ns, "
+         "adaptive %.9e %.2f ns%s\n",
+         name, dsum / ROUNDS, t_double * 1e9 / COUNT / ROUNDS, exact,
+         t_efac * 1e9 / COUNT / ROUNDS, adaptive,
+         t_adaptive * 1e9 / COUNT / ROUNDS,
+         memcmp(&exact, &adaptive, sizeof(exact)) ? " MISMATCH" : "");
+  return !!memcmp(&exact, &adaptive, sizeof(exact));
+}
+
+int main(void) {
+  int i;
+  int bad = 0;
+  float *vals = malloc(COUNT * sizeof(*vals));
+  if (!vals || !efac_init()) {
+    printf("init failed!\n");
+    return 1;
+  }
+  for (i = 0; i < COUNT; i++)
+    vals[i] = (float)rand() / RAND_MAX;
+  bad |= run("uniform", vals);
+  for (i = 0; i < COUNT; i++)
+    vals[i] = rand() % 1000;
+  bad |= run("integers", vals);
+  // exactly halfway between two floats, the double sum cannot decide
+  for (i = 0; i < COUNT; i++)
+    vals[i] = 1;
+  vals[COUNT - 1] = 0.5;
+  bad |= run("tie", vals);
+  for (i = 0; i < COUNT; i++)
+    vals[i] = 1.0 / (i + 1);
+  bad |= run("harmonic", vals);
+  // large values that cancel, the result is carried by the small ones
+  for (i = 0; i < COUNT; i++)
+    vals[i] = i & 1 ? -vals[i - 1] + 1e-7f * i : 1e10f * rand() / RAND_MAX;
+  bad |= run("cancel", vals);
+  return bad;
+}
@@ -0,0 +1,170 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libsoftefac.h"
+
+#define COUNT 20000000
+#define MAXTHREADS 64
+//! passes over the same sign values, enough for carries with all stripes
+#define BIGPASSES 4
+
+typedef struct {
+  const float *vals;
+  size_t cnt;
+  efac_atomic_t *acc;
+  pthread_mutex_t *lock;
+} part_t;
+
+static volatile int running;
+//! set while all added values are positive, the reader counts decreases
+static int increasing;
+static size_t decreases;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *add_atomic(void *arg) {
+  part_t *p = arg;
+  size_t i;
+  for (i = 0; i < p->cnt; i++)
+    efac_atomic_add(p->acc, p->vals[i]);
+  return NULL;
+}
+
+//! the usual alternative, one register behind a mutex
+static void *add_locked(void *arg) {
+  part_t *p = arg;
+  size_t i;
+  for (i = 0; i < p->cnt; i++) {
+    pthread_mutex_lock(p->lock);
+    efac_add(1, p->vals[i]);
+    pthread_mutex_unlock(p->lock);
+  }
+  return NULL;
+}
+
+//! reads the sum continuously like a metrics exporter would
+static void *reader(void *arg) {
+  efac_atomic_t *acc = arg;
+  size_t *reads = malloc(sizeof(*reads));
+  float prev = 0, sum;
+  *reads = 0;
+  while (running) {
+    efac_atomic_read(acc, 2);
+    sum = efac_read(2);
+    if (increasing && sum < prev)
+      decreases++;
+    prev = sum;
+    (*reads)++;
+  }
+  return reads;
+}
+
+static double run(void *(*fn)(void *), const float *vals, int nthreads,
+                  efac_atomic_t *acc, pthread_mutex_t *lock, size_t *reads) {
+  pthread_t threads[MAXTHREADS], rthread;
+  part_t parts[MAXTHREADS];
+  void *res;
+  double t;
+  int i;
+  running = 1;
+  if (reads)
+    pthread_create(&rthread, NULL, reader, acc);
+  t = now();
+  for (i = 0; i < nthreads; i++) {
+    parts[i].vals = vals + (size_t)COUNT * i / nthreads;
+    parts[i].cnt = (size_t)COUNT * (i + 1) / nthreads -
+                   (size_t)COUNT * i / nthreads;
+    parts[i].acc = acc;
+    parts[i].lock = lock;
+    pthread_create(&threads[i], NULL, fn, &parts[i]);
+  }
+  for (i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+  t = now() - t;
+  running = 0;
+  if (reads) {
+    pthread_join(rthread, &res);
+    *reads = *(size_t *)res;
+    free(res);
+  }
+  return t;
+}
+
+int main(int argc, char *argv[]) {
+  int maxthreads = argc > 1 ? atoi(argv[1]) : MAXTHREADS;
+  float *vals = malloc(COUNT * sizeof(*vals));
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  float *big = malloc(COUNT * sizeof(*big));
+  static uint32_t ref[512], bigref[512], buf[512];
+  int i, n, pass, failed = 0;
+  if (!vals || !big || !efac_init()) {
+    printf("init failed!\n");
+    return 1;
+  }
+  if (maxthreads < 1 || maxthreads > MAXTHREADS)
+    maxthreads = MAXTHREADS;
+  for (i = 0; i < COUNT; i++)
+    vals[i] = (rand() - RAND_MAX / 2) * (1.0f / (1 + (rand() & 0xffff)));
+  efac_clear(0);
+  efac_add_array(0, vals, COUNT);
+  efac_save(0, ref);
+  // the largest mantissa at the top of a 16 bit limb step, the limbs of
+  // the atomic register reach their carry limit after 2^21 of them
+  for (i = 0; i < COUNT; i++)
+    big[i] = ldexpf((1 << 24) - 1, 8);
+  efac_clear(0);
+  for (pass = 0; pass < BIGPASSES; pass++)
+    for (i = 0; i < COUNT; i++)
+      efac_add(0, big[i]);
+  efac_save(0, bigref);
+  printf("%7s %12s %12s %12s %10s %8s\n", "threads", "atomic Madd/s",
+         "+reader", "mutex", "reads/s", "carries");
+  // powers of two up to and including maxthreads
+  for (n = 1; ; n *= 2) {
+    efac_atomic_t *acc;
+    double ta, tr, tm;
+    size_t reads, bigreads;
+    int bad;
+    if (n > maxthreads) n = maxthreads;
+    acc = efac_atomic_create();
+    ta = run(add_atomic, vals, n, acc, NULL, NULL);
+    efac_atomic_read(acc, 2);
+    efac_save(2, buf);
+    bad = memcmp(ref, buf, sizeof(ref)) != 0;
+    efac_atomic_free(acc);
+    acc = efac_atomic_create();
+    tr = run(add_atomic, vals, n, acc, NULL, &reads);
+    efac_atomic_read(acc, 2);
+    efac_save(2, buf);
+    bad |= memcmp(ref, buf, sizeof(ref)) != 0;
+    efac_atomic_free(acc);
+    efac_clear(1);
+    tm = run(add_locked, vals, n, NULL, &lock, NULL);
+    efac_save(1, buf);
+    bad |= memcmp(ref, buf, sizeof(ref)) != 0;
+    // same sign values until the limbs carry, read all along
+    acc = efac_atomic_create();
+    increasing = 1;
+    decreases = 0;
+    for (pass = 0; pass < BIGPASSES; pass++)
+      run(add_atomic, big, n, acc, NULL, &bigreads);
+    increasing = 0;
+    efac_atomic_read(acc, 2);
+    efac_save(2, buf);
+    bad |= memcmp(bigref, buf, sizeof(bigref)) != 0 || decreases;
+    efac_atomic_free(acc);
+    printf("%7d %12.1f %12.1f %12.1f %10.0f %8s %s\n", n, COUNT / ta * 1e-6,
+           COUNT / tr * 1e-6, COUNT / tm * 1e-6, reads / tr,
+           decreases ? "decrease" : "ok", bad ? "MISMATCH" : "identical");
+    failed |= bad;
+    if (n == maxthreads) break;
+  }
+  return failed;
+}
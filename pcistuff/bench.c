@@ -0,0 +1,264 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef SOFT
+#include "libsoftefac.h"
+#define BACKEND "soft"
+//! JSON line telling whether the device was found, only for the device
+#define DEVICE(found) ""
+#else
+#include "libefac.h"
+#define BACKEND "hw"
+#define DEVICE(found) "  \"device\": " found ",\n"
+#endif
+
+// runs per measurement, the fastest one is reported
+#define REPEAT 3
+// calls per measurement for the read benchmarks, at most the value count,
+// save/restore use a 16th of that
+#define CALLS 100000
+
+enum dist { NARROW, FULL, CANCEL, DENORMAL, DISTCNT };
+static const char *const dist_names[] = {"narrow", "full", "cancel", "denormal"};
+
+enum op { NAIVE_FLOAT, NAIVE_DOUBLE, KAHAN, ADD, ADD4, SUB, ADD_ARRAY, OPCNT };
+static const char *const op_names[] = {"naive_float", "naive_double", "kahan",
+                                       "efac_add", "efac_add4", "efac_sub",
+                                       "efac_add_array"};
+
+static int first = 1;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static float int2flt(uint32_t x) {
+  union {
+    float f;
+    uint32_t i;
+  } v;
+  v.i = x;
+  return v.f;
+}
+
+static uint32_t rand32(void) {
+  return (uint32_t)rand() << 16 ^ rand();
+}
+
+static void fill(float *vals, size_t cnt, enum dist d) {
+  size_t i;
+  for (i = 0; i < cnt; i++) {
+    uint32_t r = rand32();
+    uint32_t exp;
+    switch (d) {
+    case NARROW:
+      // exponents -2 .. 2
+      exp = 125 + r % 5;
+      break;
+    case FULL:
+    case CANCEL:
+      exp = r % 255;
+      break;
+    default:
+      exp = 0;
+      break;
+    }
+    vals[i] = int2flt((r & 0x807fffff) | exp << 23);
+    if (d == CANCEL && (i & 1))
+      vals[i] = -vals[i - 1];
+  }
+}
+
+// prints one JSON result object, non-finite values as null
+static void result(const char *dist, const char *op, double t, size_t cnt,
+                   size_t bytes, double value) {
+  printf("%s\n    {\"dist\": \"%s\", \"op\": \"%s\", \"ns_per_elem\": %.3f, "
+         "\"gb_per_s\": %.3f, \"value\": ", first ? "" : ",", dist, op,
+         t / cnt * 1e9, bytes / t * 1e-9);
+  if (isfinite(value))
+    printf("%.9e}", value);
+  else
+    printf("null}");
+  first = 0;
+}
+
+static double run(enum op op, const float *vals, size_t cnt, double *value) {
+  size_t i;
+  double t = now();
+  float f = 0;
+  double d = 0, c = 0;
+  efac_clear(0);
+  switch (op) {
+  case NAIVE_FLOAT:
+    for (i = 0; i < cnt; i++)
+      f += vals[i];
+    *value = f;
+    break;
+  case NAIVE_DOUBLE:
+    for (i = 0; i < cnt; i++)
+      d += vals[i];
+    *value = d;
+    break;
+  case KAHAN:
+    for (i = 0; i < cnt; i++) {
+      double y = vals[i] - c;
+      double s = d + y;
+      c = (s - d) - y;
+      d = s;
+    }
+    *value = d;
+    break;
+  case ADD:
+    for (i = 0; i < cnt; i++)
+      efac_add(0, vals[i]);
+    break;
+  case ADD4:
+    for (i = 0; i + 4 <= cnt; i += 4)
+      efac_add4(0, vals[i], vals[i + 1], vals[i + 2], vals[i + 3]);
+    for (; i < cnt; i++)
+      efac_add(0, vals[i]);
+    break;
+  case SUB:
+    for (i = 0; i < cnt; i++)
+      efac_sub(0, vals[i]);
+    break;
+  case ADD_ARRAY:
+    efac_add_array(0, vals, cnt);
+    break;
+  default:
+    break;
+  }
+  if (op >= ADD)
+    *value = efac_read_round_nearest(0);
+  return now() - t;
+}
+
+static void bench_reads(int calls) {
+  static float (*const reads[])(int) = {
+    efac_read_round_zero, efac_read_round_inf, efac_read_round_ninf,
+    efac_read_round_pinf, efac_read_round_nearest};
+  static const char *const names[] = {
+    "efac_read_round_zero", "efac_read_round_inf", "efac_read_round_ninf",
+    "efac_read_round_pinf", "efac_read_round_nearest"};
+  static uint32_t buf[512];
+  unsigned m;
+  int i, r;
+  // the software backend caches reads, the add of 0 before each one
+  // invalidates that so the reads do the full work
+  for (m = 0; m < sizeof(reads) / sizeof(*reads); m++) {
+    char name[64];
+    double best = 1e9;
+    float v = 0;
+    for (r = 0; r < REPEAT; r++) {
+      double t = now();
+      for (i = 0; i < calls; i++) {
+        efac_add(0, 0.0f);
+        v = reads[m](0);
+      }
+      t = now() - t;
+      if (t < best) best = t;
+    }
+    snprintf(name, sizeof(name), "efac_add_0_%s", names[m] + 5);
+    result("register", name, best, calls, calls * sizeof(float), v);
+  }
+  // the add of 0 alone, and efac_read_all with and without the cache
+  for (m = 0; m < 3; m++) {
+    static const char *const names[] = {"efac_add_0", "efac_add_0_read_all",
+                                        "efac_read_all_cached"};
+    double best = 1e9;
+    float out[5] = {0};
+    efac_read_all(0, out);
+    for (r = 0; r < REPEAT; r++) {
+      double t = now();
+      for (i = 0; i < calls; i++) {
+        if (m < 2)
+          efac_add(0, 0.0f);
+        if (m)
+          efac_read_all(0, out);
+      }
+      t = now() - t;
+      if (t < best) best = t;
+    }
+    result("register", names[m], best, calls, calls * sizeof(out),
+           efac_read_round_nearest(0));
+  }
+  calls = calls / 16 + 1;
+  for (m = 0; m < 4; m++) {
+    static const char *const names[] = {"efac_save", "efac_restore",
+                                        "efac_serialize", "efac_deserialize"};
+    static uint8_t ser[EFAC_SERIAL_MAX];
+    double best = 1e9;
+    size_t len;
+    efac_save(0, buf);
+    len = efac_serialize(0, ser);
+    for (r = 0; r < REPEAT; r++) {
+      double t = now();
+      for (i = 0; i < calls; i++) {
+        switch (m) {
+        case 0:
+          efac_save(0, buf);
+          break;
+        case 1:
+          efac_restore(0, buf);
+          break;
+        case 2:
+          efac_serialize(0, ser);
+          break;
+        default:
+          efac_deserialize(0, ser, len);
+          break;
+        }
+      }
+      t = now() - t;
+      if (t < best) best = t;
+    }
+    result("register", names[m], best, calls,
+           calls * (m < 2 ? sizeof(buf) : len), efac_read_round_nearest(0));
+  }
+}
+
+int main(int argc, char *argv[]) {
+  size_t cnt = argc > 1 ? strtoul(argv[1], NULL, 0) : 1 << 24;
+  float *vals = malloc(cnt * sizeof(*vals));
+  int d, op, r;
+  if (!vals) {
+    fprintf(stderr, "out of memory!\n");
+    return 1;
+  }
+  // without a device there is still a result file, one saying so
+  if (!efac_init()) {
+    fprintf(stderr, "init failed!\n");
+    printf("{\n  \"backend\": \"%s\",\n" DEVICE("false")
+           "  \"results\": []\n}\n", BACKEND);
+    free(vals);
+    return 1;
+  }
+  srand(1);
+  printf("{\n  \"backend\": \"%s\",\n" DEVICE("true")
+         "  \"count\": %zu,\n  \"results\": [", BACKEND, cnt);
+  for (d = 0; d < DISTCNT; d++) {
+    fill(vals, cnt, d);
+    for (op = 0; op < OPCNT; op++) {
+      double best = 1e9, value = 0;
+      for (r = 0; r < REPEAT; r++) {
+        double t = run(op, vals, cnt, &value);
+        if (t < best) best = t;
+      }
+      result(dist_names[d], op_names[op], best, cnt, cnt * sizeof(*vals),
+             value);
+    }
+  }
+  // reads and save/restore of a register holding a full-range sum
+  fill(vals, cnt, FULL);
+  efac_clear(0);
+  for (r = 0; r < 4096; r++)
+    efac_add(0, vals[r % cnt]);
+  bench_reads(cnt < CALLS ? cnt : CALLS);
+  printf("\n  ]\n}\n");
+  free(vals);
+  return 0;
+}
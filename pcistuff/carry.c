@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "libsoftefac.h"
+
+#define COUNT 100000000
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run(const char *name, const float *vals) {
+  int i;
+  double t;
+  efac_clear(0);
+  t = now();
+  for (i = 0; i < COUNT; i++)
+    efac_add(0, vals[i]);
+  t = now() - t;
+  printf("%-12s %.9e (%.2f ns/value)\n", name, efac_read_round_nearest(0),
+         t * 1e9 / COUNT);
+#ifdef EFAC_STATS
+  efac_print_stats(stdout, 0);
+#endif
+}
+
+int main(void) {
+  int i;
+  float *vals = malloc(COUNT * sizeof(*vals));
+  if (!vals || !efac_init()) {
+    printf("init failed!\n");
+    return 1;
+  }
+#ifdef EFAC_DEFERRED_CARRY
+  printf("deferred carry layout\n");
+#else
+  printf("default layout\n");
+#endif
+  // the same series as sum1.c
+  for (i = 0; i < COUNT; i++)
+    vals[i] = 1.0 / (i + 1);
+  run("harmonic", vals);
+  // long borrow chains whenever the sign of the partial sum changes
+  for (i = 0; i < COUNT; i++)
+    vals[i] = rand() & 1 ? vals[i] : -vals[i];
+  run("random-sign", vals);
+  return 0;
+}
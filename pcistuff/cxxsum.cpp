@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <execution>
+#include <numeric>
+#include <vector>
+#include "efac.hpp"
+extern "C" {
+#include "libsoftefac.h"
+}
+
+#define COUNT 100000000
+
+static double now() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main() {
+  static const char *names[] = {"zero", "inf", "ninf", "pinf", "nearest"};
+  static float (*const reads[])(int) = {efac_read_round_zero, efac_read_round_inf,
+                                        efac_read_round_ninf, efac_read_round_pinf,
+                                        efac_read_round_nearest};
+  std::vector<float> vals(COUNT);
+  using acc = efac::Accumulator<float>;
+  acc seq, par, sq;
+  float naive = 0;
+  double t;
+  int bad = 0;
+  if (!efac_init()) {
+    printf("init failed!\n");
+    return 1;
+  }
+  for (auto &v : vals)
+    v = (rand() - RAND_MAX / 2) * (1.0f / (1 + (rand() & 0xffff)));
+
+  t = now();
+  for (float v : vals)
+    naive += v;
+  printf("naive float:        %.9e %6.2f ns/elem\n", naive, (now() - t) / COUNT * 1e9);
+
+  t = now();
+  for (float v : vals)
+    seq += v;
+  printf("Accumulator +=:     %.9e %6.2f ns/elem\n", seq.value(), (now() - t) / COUNT * 1e9);
+
+  t = now();
+  par = std::reduce(std::execution::par_unseq, vals.begin(), vals.end(), acc(),
+                    efac::plus<float>());
+  printf("reduce par_unseq:   %.9e %6.2f ns/elem %s\n", par.value(),
+         (now() - t) / COUNT * 1e9, par == seq ? "identical" : "MISMATCH");
+  bad += par != seq;
+
+  // negating every value must give the exact negation of the sum
+  t = now();
+  sq = std::transform_reduce(std::execution::par_unseq, vals.begin(), vals.end(),
+                             acc(), efac::plus<float>(), [](float v) { return acc(-v); });
+  printf("transform_reduce:   %.9e %6.2f ns/elem %s\n", sq.value(),
+         (now() - t) / COUNT * 1e9, sq == -seq ? "identical" : "MISMATCH");
+  bad += sq != -seq;
+
+  efac_clear(0);
+  efac_add_array(0, vals.data(), COUNT);
+  for (int m = 0; m < 5; m++) {
+    float a = seq.value(efac::rounding(m)), b = reads[m](0);
+    bool same = !memcmp(&a, &b, sizeof(a));
+    printf("round %-8s %.9e %s\n", names[m], a, same ? "ok" : "MISMATCH vs libsoftefac");
+    bad += !same;
+  }
+  printf("as double:          %.17e\n", seq.value<double>());
+  return bad != 0;
+}
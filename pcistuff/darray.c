@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libsoftefac.h"
+
+#define COUNT 1000003
+
+/*
+ * The double array functions against per value efac_add_double and
+ * efac_sub_double. Besides comparing the reads, the per value results
+ * are taken back out of the array register, which has to leave exactly
+ * zero whatever the rounding mode.
+ */
+static double bits(uint64_t i) {
+  union {
+    uint64_t i;
+    double d;
+  } v;
+  v.i = i;
+  return v.d;
+}
+
+static uint64_t rand64(void) {
+  return (uint64_t)rand() << 42 ^ (uint64_t)rand() << 21 ^ rand();
+}
+
+static void read_all(int reg, double out[5]) {
+  out[0] = efac_read_double_round_zero(reg);
+  out[1] = efac_read_double_round_inf(reg);
+  out[2] = efac_read_double_round_ninf(reg);
+  out[3] = efac_read_double_round_pinf(reg);
+  out[4] = efac_read_double_round_nearest(reg);
+}
+
+//! 0 if everything matches, sum is the nearest read of the sum
+static int check(const double *vals, size_t cnt, double *sum) {
+  static const double zero[5];
+  double ref[5], out[5], rest[5];
+  int bad;
+  size_t i;
+  // adds
+  efac_clear_double(0);
+  efac_clear_double(1);
+  for (i = 0; i < cnt; i++)
+    efac_add_double(0, vals[i]);
+  efac_add_double_array(1, vals, cnt);
+  read_all(0, ref);
+  read_all(1, out);
+  for (i = 0; i < cnt; i++)
+    efac_sub_double(1, vals[i]);
+  read_all(1, rest);
+  bad = memcmp(ref, out, sizeof(ref)) || memcmp(rest, zero, sizeof(zero));
+  // subtractions
+  efac_clear_double(0);
+  efac_clear_double(1);
+  for (i = 0; i < cnt; i++)
+    efac_sub_double(0, vals[i]);
+  efac_sub_double_array(1, vals, cnt);
+  read_all(0, ref);
+  read_all(1, out);
+  for (i = 0; i < cnt; i++)
+    efac_add_double(1, vals[i]);
+  read_all(1, rest);
+  bad |= memcmp(ref, out, sizeof(ref)) || memcmp(rest, zero, sizeof(zero));
+  *sum = -ref[4];
+  return bad;
+}
+
+static int run(const char *name, const double *vals, size_t cnt) {
+  double sum;
+  int bad = check(vals, cnt, &sum);
+  printf("%-10s %.17e %s\n", name, sum, bad ? "MISMATCH" : "identical");
+  return bad;
+}
+
+int main(void) {
+  double *vals = malloc(COUNT * sizeof(*vals));
+  double sum;
+  int bad = 0, tails = 0;
+  int i, large = 0;
+  if (!vals || !efac_init()) {
+    printf("init failed!\n");
+    return 1;
+  }
+  // denormals and +-0 among the smallest normals
+  for (i = 0; i < COUNT; i++) {
+    uint64_t r = rand64();
+    vals[i] = bits(r & (r & 1 ? 0x800fffffffffffffULL : 0x803fffffffffffffULL));
+  }
+  bad |= run("denormals", vals, COUNT);
+  // the largest exponents, the sum is beyond the double range
+  for (i = 0; i < COUNT; i++)
+    vals[i] = bits((rand64() & 0x800fffffffffffffULL) |
+                   (uint64_t)(2030 + rand() % 17) << 52);
+  bad |= run("large", vals, COUNT);
+  // both ends at once, the large values cancel in pairs
+  for (i = 0; i < COUNT; i++) {
+    if (i & 1 && large)
+      vals[i] = -vals[i - 1];
+    else if ((large = !(i & 1) && rand() & 1))
+      vals[i] = bits((rand64() & 0x800fffffffffffffULL) |
+                     0x7fe0000000000000ULL);
+    else
+      vals[i] = bits(rand64() & 0x801fffffffffffffULL);
+  }
+  bad |= run("cancel", vals, COUNT);
+  // short arrays for the tails
+  for (i = 1; i < 40; i++)
+    tails |= check(vals + 2 * i, i, &sum);
+  printf("%-10s %s\n", "short", tails ? "MISMATCH" : "identical");
+  bad |= tails;
+  free(vals);
+  return bad;
+}
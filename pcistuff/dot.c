@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "libsoftefac.h"
+
+#define COUNT 10000000
+#define ROUNDS 10
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+  int i, r;
+  float *a = malloc(COUNT * sizeof(*a));
+  float *b = malloc(COUNT * sizeof(*b));
+  float sdot = 0;
+  double ddot = 0;
+  double t_float, t_double, t_efac;
+  if (!a || !b || !efac_init()) {
+    printf("init failed!\n");
+    return 1;
+  }
+  // badly conditioned: pairs of large products that cancel exactly
+  // and small ones that carry the actual result
+  for (i = 0; i < COUNT; i++) {
+    a[i] = (float)rand() / RAND_MAX - 0.5;
+    b[i] = (float)rand() / RAND_MAX * 1e8f;
+    if (i % 3 == 1) {
+      a[i] = a[i - 1];
+      b[i] = -b[i - 1];
+    } else if (i % 3 == 2)
+      b[i] *= 1e-12f;
+  }
+  efac_clear(0);
+  t_float = now();
+  for (r = 0; r < ROUNDS; r++)
+    for (i = 0; i < COUNT; i++)
+      sdot += a[i] * b[i];
+  t_float = now() - t_float;
+  t_double = now();
+  for (r = 0; r < ROUNDS; r++)
+    for (i = 0; i < COUNT; i++)
+      ddot += (double)a[i] * b[i];
+  t_double = now() - t_double;
+  t_efac = now();
+  for (r = 0; r < ROUNDS; r++)
+    efac_dot(0, a, b, COUNT);
+  t_efac = now() - t_efac;
+  printf("float:  %.9e (%.2f ns/element)\n", sdot, t_float * 1e9 / COUNT / ROUNDS);
+  printf("double: %.9e (%.2f ns/element)\n", ddot, t_double * 1e9 / COUNT / ROUNDS);
+  printf("efac:   %.9e (%.2f ns/element)\n", efac_read_round_nearest(0), t_efac * 1e9 / COUNT / ROUNDS);
+  return 0;
+}
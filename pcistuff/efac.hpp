@@ -0,0 +1,302 @@
+#ifndef EFAC_HPP
+#define EFAC_HPP
+
+/**
+ * \file
+ * Header-only exact accumulator with value semantics.
+ *
+ * Same idea as libsoftefac, but the register size follows from the input
+ * format at compile time and accumulators are ordinary objects instead of
+ * numbered global registers.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace efac {
+
+//! rounding modes, same meaning as the efac_read_round_* functions
+enum class rounding { zero, inf, ninf, pinf, nearest };
+
+//! raw bfloat16 value
+struct bfloat16 {
+  uint16_t bits;
+};
+
+//! raw IEEE half precision value
+struct half {
+  uint16_t bits;
+};
+
+//! bit layout of the supported input and output formats
+template <class T> struct format;
+
+template <> struct format<float> {
+  using bits_t = uint32_t;
+  static constexpr int exp_bits = 8;
+  static constexpr int mant_bits = 23;
+};
+
+template <> struct format<double> {
+  using bits_t = uint64_t;
+  static constexpr int exp_bits = 11;
+  static constexpr int mant_bits = 52;
+};
+
+template <> struct format<bfloat16> {
+  using bits_t = uint16_t;
+  static constexpr int exp_bits = 8;
+  static constexpr int mant_bits = 7;
+};
+
+template <> struct format<half> {
+  using bits_t = uint16_t;
+  static constexpr int exp_bits = 5;
+  static constexpr int mant_bits = 10;
+};
+
+template <class T> inline typename format<T>::bits_t to_bits(T v) {
+  typename format<T>::bits_t b;
+  static_assert(sizeof(b) == sizeof(v), "unexpected format size");
+  std::memcpy(&b, &v, sizeof(b));
+  return b;
+}
+
+template <class T> inline T from_bits(typename format<T>::bits_t b) {
+  T v;
+  std::memcpy(&v, &b, sizeof(b));
+  return v;
+}
+
+/**
+ * Exact accumulator for values of type Format.
+ * The value is kept as a two's complement fixed-point number whose lowest
+ * bit is the smallest denormal of Format, with Headroom bits above the
+ * largest finite value, so at least 2^Headroom maximal values can be
+ * added before it could overflow.
+ * Adding Inf or NaN makes every read return +Inf, like the overflow flag
+ * of the C libraries.
+ */
+template <class Format, int Headroom = 64> class Accumulator {
+  using fmt = format<Format>;
+  using bits_t = typename fmt::bits_t;
+
+public:
+  static constexpr int exp_mask = (1 << fmt::exp_bits) - 1;
+  //! bits from the smallest denormal to the sign bit
+  static constexpr int bits = exp_mask - 1 + fmt::mant_bits + Headroom + 1;
+  static constexpr int limbs = (bits + 63) / 64;
+  //! exponent of the lowest bit
+  static constexpr int lsb_exp = 2 - (1 << (fmt::exp_bits - 1)) - fmt::mant_bits;
+  static_assert((exp_mask - 2) / 64 + 2 <= limbs, "Headroom too small");
+
+  Accumulator() : limb_(), special_(false) {}
+  Accumulator(Format v) : Accumulator() { add(v, false); }
+
+  Accumulator &operator+=(Format v) {
+    add(v, false);
+    return *this;
+  }
+
+  Accumulator &operator-=(Format v) {
+    add(v, true);
+    return *this;
+  }
+
+  //! exact merge
+  Accumulator &operator+=(const Accumulator &o) {
+    uint64_t carry = 0;
+    for (int i = 0; i < limbs; i++) {
+      uint64_t old = limb_[i];
+      limb_[i] += o.limb_[i] + carry;
+      carry = carry ? limb_[i] <= old : limb_[i] < old;
+    }
+    special_ |= o.special_;
+    return *this;
+  }
+
+  Accumulator &operator-=(const Accumulator &o) { return *this += -o; }
+
+  Accumulator operator-() const {
+    Accumulator r(*this);
+    uint64_t carry = 1;
+    for (int i = 0; i < limbs; i++) {
+      r.limb_[i] = ~r.limb_[i] + carry;
+      carry = carry && !r.limb_[i];
+    }
+    return r;
+  }
+
+  friend Accumulator operator+(Accumulator a, const Accumulator &b) { return a += b; }
+  friend Accumulator operator+(Accumulator a, Format b) { return a += b; }
+  friend Accumulator operator+(Format a, Accumulator b) { return b += a; }
+  friend Accumulator operator-(Accumulator a, const Accumulator &b) { return a -= b; }
+  friend Accumulator operator-(Accumulator a, Format b) { return a -= b; }
+
+  bool operator==(const Accumulator &o) const {
+    return special_ == o.special_ && !std::memcmp(limb_, o.limb_, sizeof(limb_));
+  }
+  bool operator!=(const Accumulator &o) const { return !(*this == o); }
+
+  bool is_negative() const { return limb_[limbs - 1] >> 63; }
+  bool is_special() const { return special_; }
+
+  //! rounds the exact value once, into any of the supported formats
+  template <class To = Format> To value(rounding mode = rounding::nearest) const;
+
+  explicit operator Format() const { return value(); }
+
+private:
+  void add(Format v, bool negate) {
+    constexpr bits_t mant_mask = (bits_t(1) << fmt::mant_bits) - 1;
+    bits_t b = to_bits(v);
+    int exp = (b >> fmt::mant_bits) & exp_mask;
+    uint64_t mant = (b & mant_mask) | (exp ? mant_mask + 1 : 0);
+    bool neg = ((b >> (fmt::exp_bits + fmt::mant_bits)) & 1) ^ negate;
+    if (exp == exp_mask) {
+      special_ = true;
+      return;
+    }
+    if (!mant)
+      return;
+    // denormals have the scale of exponent 1
+    int pos = (exp | !exp) - 1;
+    int shift = pos & 63;
+    uint64_t lo = mant << shift;
+    uint64_t hi = shift ? mant >> (64 - shift) : 0;
+    pos >>= 6;
+    if (neg)
+      sub_at(pos, lo, hi);
+    else
+      add_at(pos, lo, hi);
+  }
+
+  void add_at(int pos, uint64_t lo, uint64_t hi) {
+    uint64_t old = limb_[pos];
+    uint64_t carry;
+    limb_[pos] += lo;
+    carry = limb_[pos] < old;
+    old = limb_[pos + 1];
+    limb_[pos + 1] += hi + carry;
+    carry = carry ? limb_[pos + 1] <= old : limb_[pos + 1] < old;
+    for (int i = pos + 2; carry && i < limbs; i++)
+      carry = !++limb_[i];
+  }
+
+  void sub_at(int pos, uint64_t lo, uint64_t hi) {
+    uint64_t old = limb_[pos];
+    uint64_t borrow;
+    limb_[pos] -= lo;
+    borrow = limb_[pos] > old;
+    old = limb_[pos + 1];
+    limb_[pos + 1] -= hi + borrow;
+    borrow = borrow ? limb_[pos + 1] >= old : limb_[pos + 1] > old;
+    for (int i = pos + 2; borrow && i < limbs; i++)
+      borrow = !limb_[i]--;
+  }
+
+  //! bits [from, from + 64) of the magnitude m, from may be negative
+  static uint64_t extract(const uint64_t *m, int from) {
+    if (from <= -64 || from >= limbs * 64)
+      return 0;
+    if (from < 0)
+      return m[0] << -from;
+    int i = from >> 6, s = from & 63;
+    uint64_t r = m[i] >> s;
+    if (s && i + 1 < limbs)
+      r |= m[i + 1] << (64 - s);
+    return r;
+  }
+
+  //! is any bit below bit n of the magnitude m set
+  static bool any_below(const uint64_t *m, int n) {
+    for (int i = 0; i < limbs && n > 0; i++, n -= 64)
+      if (n >= 64 ? m[i] : m[i] & ((uint64_t(1) << n) - 1))
+        return true;
+    return false;
+  }
+
+  uint64_t limb_[limbs];
+  bool special_;
+};
+
+template <class Format, int Headroom>
+template <class To>
+To Accumulator<Format, Headroom>::value(rounding mode) const {
+  using tfmt = format<To>;
+  using tbits = typename tfmt::bits_t;
+  constexpr int prec = tfmt::mant_bits + 1;
+  constexpr int bias = (1 << (tfmt::exp_bits - 1)) - 1;
+  constexpr int emin = 2 - bias - prec;
+  constexpr tbits inf = tbits((1 << tfmt::exp_bits) - 1) << tfmt::mant_bits;
+  static_assert(prec < 64, "target precision too large");
+  uint64_t mag[limbs];
+  bool sign = is_negative();
+  int top = -1;
+  if (special_)
+    return from_bits<To>(inf);
+  uint64_t carry = sign;
+  for (int i = 0; i < limbs; i++) {
+    mag[i] = (sign ? ~limb_[i] : limb_[i]) + carry;
+    carry = carry && !mag[i];
+    if (mag[i])
+      top = i;
+  }
+  tbits sbit = tbits(sign) << (tfmt::exp_bits + tfmt::mant_bits);
+  if (top < 0)
+    return from_bits<To>(sbit);
+  int h = top * 64 + 63 - __builtin_clzll(mag[top]);
+  // lowest result bit, as exponent and as bit index into mag
+  int lsb = h + lsb_exp - (prec - 1);
+  if (lsb < emin)
+    lsb = emin;
+  int shift = lsb - lsb_exp;
+  uint64_t q = extract(mag, shift);
+  bool rbit = shift > 0 && (extract(mag, shift - 1) & 1);
+  bool sticky = shift > 1 && any_below(mag, shift - 1);
+  bool away;
+  switch (mode) {
+  case rounding::zero:    away = false; break;
+  case rounding::inf:     away = rbit || sticky; break;
+  case rounding::ninf:    away = sign && (rbit || sticky); break;
+  case rounding::pinf:    away = !sign && (rbit || sticky); break;
+  default:             away = rbit && (sticky || (q & 1)); break;
+  }
+  q += away;
+  if (q >> prec) {
+    q >>= 1;
+    lsb++;
+  }
+  // largest finite value has lsb == bias - prec + 1
+  if (lsb > bias - prec + 1) {
+    bool to_inf = mode == rounding::inf || mode == rounding::nearest ||
+                  (mode == rounding::ninf && sign) || (mode == rounding::pinf && !sign);
+    return from_bits<To>(sbit | (to_inf ? inf : inf - 1));
+  }
+  if (q >> (prec - 1))
+    return from_bits<To>(sbit | (tbits(lsb - emin + 1) << tfmt::mant_bits) |
+                         (tbits(q) & ((tbits(1) << tfmt::mant_bits) - 1)));
+  return from_bits<To>(sbit | tbits(q));
+}
+
+/**
+ * Exact addition for std::reduce and friends. std::plus would add two
+ * plain values in their own format and round.
+ * \code
+ * auto sum = std::reduce(std::execution::par_unseq, v.begin(), v.end(),
+ *                        efac::Accumulator<float>(), efac::plus<float>());
+ * float res = sum.value(efac::rounding::nearest);
+ * \endcode
+ */
+template <class Format, int Headroom = 64> struct plus {
+  using acc = Accumulator<Format, Headroom>;
+  acc operator()(acc a, const acc &b) const { return a += b; }
+  acc operator()(acc a, Format b) const { return a += b; }
+  acc operator()(Format a, acc b) const { return b += a; }
+  acc operator()(Format a, Format b) const { return acc(a) += b; }
+};
+
+} // namespace efac
+
+#endif /* EFAC_HPP */
@@ -0,0 +1,55 @@
+#ifndef EFAC_FIXED_H
+#define EFAC_FIXED_H
+
+/*
+ * Integer and fixed-point access to the register blocks, shared by
+ * libefac and libsoftefac. A fixed-point value v with scale_bits s
+ * stands for v * 2^-s, integers are s = 0.
+ */
+
+#include <inttypes.h>
+
+//! range of scale_bits, every bit of an int64 * 2^-scale_bits and of
+//! sums of 2^16 of them is inside the float range
+#define EFAC_FIXED_MIN (-48)
+#define EFAC_FIXED_MAX 149
+//! register bit holding 2^0, counted from the lowest bit of block 0
+#define EFAC_FIXED_ONE 375
+//! number of register blocks
+#define EFAC_FIXED_BLOCKS 23
+
+/**
+ * Fixed-point value of a register, rounded towards -infinity
+ * \param blocks register blocks, lowest first; those below bit
+ *        EFAC_FIXED_ONE - scale_bits are not used
+ * \param flags sign in bit 0, overflow in bit 1
+ * \param scale_bits fixed-point scale, EFAC_FIXED_MIN to EFAC_FIXED_MAX
+ * \param val [out] the value, its low 64 bits if it does not fit
+ * \return 0 if the value fits into val, 1 if not or on overflow
+ */
+static inline int efac_fixed_from_blocks(const uint32_t *blocks,
+                                         uint32_t flags, int scale_bits,
+                                         int64_t *val) {
+  uint32_t ext = -(flags & 1);
+  int lo = EFAC_FIXED_ONE - scale_bits;
+  int bad = !!(flags & 2);
+  uint64_t v = 0;
+  int i;
+  for (i = lo / 32; i < EFAC_FIXED_BLOCKS; i++) {
+    int d = 32 * i - lo;
+    // bits above the 64 of val have to be sign extension
+    int above = lo + 64 - 32 * i;
+    if (d < 0)
+      v |= blocks[i] >> -d;
+    else if (d < 64)
+      v |= (uint64_t)blocks[i] << d;
+    if (above <= 0)
+      bad |= blocks[i] != ext;
+    else if (above < 32)
+      bad |= ((blocks[i] ^ ext) >> above) != 0;
+  }
+  *val = v;
+  return bad || (uint32_t)-(v >> 63) != ext;
+}
+
+#endif /* EFAC_FIXED_H */
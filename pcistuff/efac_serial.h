@@ -0,0 +1,121 @@
+#ifndef EFAC_SERIAL_H
+#define EFAC_SERIAL_H
+
+/*
+ * Compact serialized register state, shared by libefac and libsoftefac.
+ *
+ * Version 1 layout, varints are LEB128:
+ *   byte    version
+ *   varint  flags, bit 0 sign, bit 1 overflow
+ *   varint  read offset, zigzag encoded
+ *   varint  write offset, zigzag encoded
+ *   varint  bitmap of the blocks that are stored
+ *   4 bytes per stored block, little endian, lowest block first
+ * Blocks not in the bitmap are sign extension (0 or 0xffffffff).
+ */
+
+#include <inttypes.h>
+#include <stddef.h>
+
+//! current serialization format version
+#define EFAC_SERIAL_VERSION 1
+//! number of blocks in a register
+#define EFAC_SERIAL_BLOCKS 23
+//! maximum size of one serialized register
+#define EFAC_SERIAL_MAX (1 + 1 + 3 + 3 + 4 + 4 * EFAC_SERIAL_BLOCKS)
+
+static inline uint8_t *efac_put_varint(uint8_t *p, uint32_t v) {
+  while (v >= 0x80) {
+    *p++ = v | 0x80;
+    v >>= 7;
+  }
+  *p++ = v;
+  return p;
+}
+
+//! \return pointer behind the varint, NULL if it is truncated or too long
+static inline const uint8_t *efac_get_varint(const uint8_t *p,
+                                             const uint8_t *end, uint32_t *v) {
+  int shift;
+  *v = 0;
+  for (shift = 0; shift < 35 && p < end; shift += 7) {
+    *v |= (uint32_t)(*p & 0x7f) << shift;
+    if (!(*p++ & 0x80))
+      return p;
+  }
+  return NULL;
+}
+
+/**
+ * Serialize register state
+ * \param buf buffer of at least EFAC_SERIAL_MAX bytes
+ * \param flags sign in bit 0, overflow in bit 1
+ * \param rofs read exponent offset
+ * \param wofs write exponent offset
+ * \param blocks register blocks, lowest first
+ * \return number of bytes written
+ */
+static inline size_t efac_encode(uint8_t *buf, uint32_t flags, int16_t rofs,
+                                 int16_t wofs, const uint32_t *blocks) {
+  uint32_t ext = -(flags & 1);
+  uint32_t map = 0;
+  uint8_t *p = buf;
+  int i;
+  for (i = 0; i < EFAC_SERIAL_BLOCKS; i++)
+    if (blocks[i] != ext)
+      map |= 1 << i;
+  *p++ = EFAC_SERIAL_VERSION;
+  p = efac_put_varint(p, flags & 3);
+  p = efac_put_varint(p, (uint32_t)rofs << 1 ^ -(uint32_t)(rofs < 0));
+  p = efac_put_varint(p, (uint32_t)wofs << 1 ^ -(uint32_t)(wofs < 0));
+  p = efac_put_varint(p, map);
+  for (i = 0; i < EFAC_SERIAL_BLOCKS; i++) {
+    if (!(map & (1 << i)))
+      continue;
+    p[0] = blocks[i];
+    p[1] = blocks[i] >> 8;
+    p[2] = blocks[i] >> 16;
+    p[3] = blocks[i] >> 24;
+    p += 4;
+  }
+  return p - buf;
+}
+
+/**
+ * Deserialize register state, see efac_encode for the parameters
+ * \param len number of bytes available in buf
+ * \return number of bytes used, 0 if buf is not valid
+ */
+static inline size_t efac_decode(const uint8_t *buf, size_t len,
+                                 uint32_t *flags, int16_t *rofs,
+                                 int16_t *wofs, uint32_t *blocks) {
+  const uint8_t *p = buf;
+  const uint8_t *end = buf + len;
+  uint32_t map, v;
+  int i;
+  if (!len || *p++ != EFAC_SERIAL_VERSION)
+    return 0;
+  if (!(p = efac_get_varint(p, end, flags)) || *flags > 3)
+    return 0;
+  if (!(p = efac_get_varint(p, end, &v)))
+    return 0;
+  *rofs = v >> 1 ^ -(v & 1);
+  if (!(p = efac_get_varint(p, end, &v)))
+    return 0;
+  *wofs = v >> 1 ^ -(v & 1);
+  if (!(p = efac_get_varint(p, end, &map)) || map >> EFAC_SERIAL_BLOCKS)
+    return 0;
+  for (i = 0; i < EFAC_SERIAL_BLOCKS; i++) {
+    if (!(map & (1 << i))) {
+      blocks[i] = -(*flags & 1);
+      continue;
+    }
+    if (end - p < 4)
+      return 0;
+    blocks[i] = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+    p += 4;
+  }
+  return p - buf;
+}
+
+#endif /* EFAC_SERIAL_H */
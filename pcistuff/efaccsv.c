@@ -0,0 +1,340 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libsoftefac.h"
+
+#define MAXCOLS 256
+#define MAXTHREADS 256
+//! bytes per work item, moved to the next line start
+#define CHUNK (4 << 20)
+//! size of each of the two stdin buffers, one is read while the other
+//! is parsed
+#ifndef STREAMBUF
+#define STREAMBUF (64 << 20)
+#endif
+
+const char help_text[] =
+  "usage: efaccsv [-c columns] [-d delimiter] [-H] [-j threads] [-v]\n"
+  "               [file ...]\n"
+  "Exact sums of decimal columns of CSV or TSV text, printed rounded in\n"
+  "every mode: zero, inf (away from zero), ninf, pinf and nearest.\n"
+  "Reads stdin without files. All files are summed together.\n"
+  "  -c columns    comma separated 1-based field numbers (default 1)\n"
+  "  -d delimiter  field delimiter, \\t or tab for TSV (default ,)\n"
+  "  -H            skip the first line of each input\n"
+  "  -j threads    number of worker threads (default: one per CPU)\n"
+  "  -v            print throughput to stderr\n"
+  "Quoted fields may contain the delimiter, but no line breaks.\n";
+
+static const char *mode_names[5] = {"zero", "inf", "ninf", "pinf", "nearest"};
+
+typedef struct {
+  const char *data;
+  size_t len;
+  //! next chunk to hand out, shared by all workers
+  size_t next;
+} job_t;
+
+typedef struct {
+  pthread_t thread;
+  job_t *job;
+  //! sums of this thread, kept across jobs
+  efac_csv_t *csv;
+} worker_t;
+
+//! position after the line break at or after p, end if there is none
+static const char *next_line(const char *p, const char *end) {
+  const char *nl = memchr(p, '\n', end - p);
+  return nl ? nl + 1 : end;
+}
+
+/**
+ * Worker: grab chunks until none are left. Chunk i gets the lines that
+ * start in it, so each line is parsed exactly once.
+ */
+static void *worker(void *arg) {
+  worker_t *w = arg;
+  job_t *job = w->job;
+  const char *end = job->data + job->len;
+  while (1) {
+    size_t lo = __sync_fetch_and_add(&job->next, CHUNK);
+    const char *start, *stop;
+    if (lo >= job->len)
+      break;
+    start = lo ? next_line(job->data + lo - 1, end) : job->data;
+    stop = lo + CHUNK < job->len ? next_line(job->data + lo + CHUNK - 1, end)
+                                 : end;
+    if (start < stop)
+      efac_csv_parse(w->csv, start, stop - start, 1);
+  }
+  return NULL;
+}
+
+static int start_job(worker_t *workers, int nthreads, job_t *job,
+                     const char *data, size_t len) {
+  int i;
+  job->data = data;
+  job->len = len;
+  job->next = 0;
+  for (i = 0; i < nthreads; i++) {
+    workers[i].job = job;
+    if (pthread_create(&workers[i].thread, NULL, worker, &workers[i])) {
+      // run the job with the threads we have
+      if (!i)
+        worker(&workers[0]);
+      return i;
+    }
+  }
+  return i;
+}
+
+static void finish_job(worker_t *workers, int started) {
+  int i;
+  for (i = 0; i < started; i++)
+    pthread_join(workers[i].thread, NULL);
+}
+
+static int sum_file(int fd, const char *name, size_t size, int header,
+                    worker_t *workers, int nthreads) {
+  job_t job;
+  void *map;
+  const char *data, *start;
+  if (!size)
+    return 1;
+  map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "efaccsv: %s: %s\n", name, strerror(errno));
+    return 0;
+  }
+  madvise(map, size, MADV_SEQUENTIAL);
+  madvise(map, size, MADV_WILLNEED);
+  data = map;
+  start = header ? next_line(data, data + size) : data;
+  finish_job(workers, start_job(workers, nthreads, &job, start,
+                                data + size - start));
+  munmap(map, size);
+  return 1;
+}
+
+static ssize_t read_full(int fd, char *buf, size_t len) {
+  size_t got = 0;
+  while (got < len) {
+    ssize_t n = read(fd, buf + got, len - got);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    if (!n)
+      break;
+    got += n;
+  }
+  return got;
+}
+
+/**
+ * Parse a pipe or other stream. The complete lines of a buffer are
+ * parsed while the next one is read, the partial last line is copied
+ * to the start of the next buffer first.
+ */
+static int sum_stream(int fd, const char *name, int header,
+                      worker_t *workers, int nthreads, size_t *total) {
+  char *buf[2];
+  job_t job;
+  size_t have = 0;
+  ssize_t got, next = 0;
+  int cur = 0;
+  int ok = 1;
+  buf[0] = malloc(STREAMBUF);
+  buf[1] = malloc(STREAMBUF);
+  if (!buf[0] || !buf[1]) {
+    fprintf(stderr, "efaccsv: out of memory\n");
+    free(buf[0]);
+    free(buf[1]);
+    return 0;
+  }
+  got = read_full(fd, buf[cur], STREAMBUF);
+  while (got >= 0) {
+    const char *data = buf[cur];
+    const char *end = data + have + got;
+    const char *stop = end;
+    int started;
+    *total += got;
+    if (header) {
+      data = next_line(data, end);
+      // a header longer than the buffer is not supported
+      header = data == end && (size_t)got == STREAMBUF - have;
+      if (header) {
+        got = read_full(fd, buf[cur], STREAMBUF);
+        continue;
+      }
+    }
+    // the last line might continue in the next buffer
+    if (got)
+      while (stop > data && stop[-1] != '\n')
+        stop--;
+    if (got && stop == data && end - data == STREAMBUF) {
+      fprintf(stderr, "efaccsv: %s: line longer than %d bytes\n", name,
+              STREAMBUF);
+      ok = 0;
+      break;
+    }
+    started = start_job(workers, nthreads, &job, data, stop - data);
+    have = end - stop;
+    memcpy(buf[cur ^ 1], stop, have);
+    if (got)
+      next = read_full(fd, buf[cur ^ 1] + have, STREAMBUF - have);
+    finish_job(workers, started);
+    if (!got)
+      break;
+    got = next;
+    cur ^= 1;
+  }
+  if (got < 0) {
+    fprintf(stderr, "efaccsv: %s: %s\n", name, strerror(errno));
+    ok = 0;
+  }
+  free(buf[0]);
+  free(buf[1]);
+  return ok;
+}
+
+static int sum_fd(int fd, const char *name, int header, worker_t *workers,
+                  int nthreads, size_t *total) {
+  struct stat st;
+  if (fstat(fd, &st)) {
+    fprintf(stderr, "efaccsv: %s: %s\n", name, strerror(errno));
+    return 0;
+  }
+  if (!S_ISREG(st.st_mode))
+    return sum_stream(fd, name, header, workers, nthreads, total);
+  *total += st.st_size;
+  return sum_file(fd, name, st.st_size, header, workers, nthreads);
+}
+
+static int parse_columns(const char *s, int *cols) {
+  int n = 0;
+  while (*s) {
+    char *end;
+    long c = strtol(s, &end, 10);
+    if (end == s || c < 1 || c > 1 << 20 || n == MAXCOLS ||
+        (*end && *end != ','))
+      return 0;
+    cols[n++] = c - 1;
+    s = *end ? end + 1 : end;
+  }
+  return n;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+  static worker_t workers[MAXTHREADS];
+  int cols[MAXCOLS] = {0};
+  int ncols = 1;
+  char delim = ',';
+  int header = 0;
+  size_t total = 0;
+  int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  int verbose = 0;
+  int ok = 1;
+  efac_csv_t *sum;
+  int opt, i, mode;
+  double t;
+  while ((opt = getopt(argc, argv, "c:d:Hj:vh")) != -1) {
+    switch (opt) {
+    case 'c':
+      if (!(ncols = parse_columns(optarg, cols))) {
+        fprintf(stderr, "efaccsv: invalid columns '%s'\n", optarg);
+        return 2;
+      }
+      break;
+    case 'd':
+      if (!strcmp(optarg, "\\t") || !strcmp(optarg, "tab"))
+        delim = '\t';
+      else if (strlen(optarg) == 1)
+        delim = optarg[0];
+      else {
+        fprintf(stderr, "efaccsv: invalid delimiter '%s'\n", optarg);
+        return 2;
+      }
+      break;
+    case 'H':
+      header = 1;
+      break;
+    case 'j':
+      nthreads = atoi(optarg);
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    default:
+      fputs(help_text, opt == 'h' ? stdout : stderr);
+      return opt == 'h' ? 0 : 2;
+    }
+  }
+  if (nthreads <= 0)
+    nthreads = 1;
+  if (nthreads > MAXTHREADS)
+    nthreads = MAXTHREADS;
+  if (!efac_init()) {
+    fprintf(stderr, "efaccsv: init failed!\n");
+    return 1;
+  }
+  sum = efac_csv_create(delim, cols, ncols);
+  if (!sum) {
+    fprintf(stderr, "efaccsv: invalid columns or delimiter\n");
+    return 2;
+  }
+  for (i = 0; i < nthreads; i++) {
+    if (!(workers[i].csv = efac_csv_create(delim, cols, ncols))) {
+      fprintf(stderr, "efaccsv: out of memory\n");
+      return 1;
+    }
+  }
+  t = now();
+  if (optind == argc)
+    ok = sum_fd(0, "stdin", header, workers, nthreads, &total);
+  for (i = optind; i < argc; i++) {
+    int fd = !strcmp(argv[i], "-") ? 0 : open(argv[i], O_RDONLY);
+    if (fd < 0) {
+      fprintf(stderr, "efaccsv: %s: %s\n", argv[i], strerror(errno));
+      ok = 0;
+      continue;
+    }
+    ok &= sum_fd(fd, argv[i], header, workers, nthreads, &total);
+    if (fd)
+      close(fd);
+  }
+  for (i = 0; i < nthreads; i++) {
+    efac_csv_merge(sum, workers[i].csv);
+    efac_csv_free(workers[i].csv);
+  }
+  t = now() - t;
+  for (i = 0; i < ncols; i++) {
+    double out[5];
+    efac_csv_read(sum, i, out);
+    printf("%d count %zu", cols[i] + 1, efac_csv_count(sum, i));
+    for (mode = 0; mode < 5; mode++)
+      printf(" %s %.17g", mode_names[mode], out[mode]);
+    printf("\n");
+    if (efac_csv_invalid(sum, i))
+      fprintf(stderr, "efaccsv: column %d: %zu fields are not numbers\n",
+              cols[i] + 1, efac_csv_invalid(sum, i));
+  }
+  if (verbose)
+    fprintf(stderr, "%zu bytes in %.3f s, %.2f GB/s\n", total, t,
+            total / t * 1e-9);
+  efac_csv_free(sum);
+  return !ok;
+}
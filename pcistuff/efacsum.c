@@ -0,0 +1,416 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libsoftefac_int.h"
+
+#define MAXCOLS 64
+#define MAXTHREADS 256
+//! bytes per work item, records are never split
+#define CHUNK (4 << 20)
+//! work items per thread that are read ahead of the workers
+#define AHEAD 4
+//! values of a column copied together before adding them, fits into L1
+#define GATHER 1024
+//! size of each of the two stdin buffers, one is read while the other
+//! is summed
+#define STREAMBUF (64 << 20)
+
+const char help_text[] =
+  "usage: efacsum [-l layout] [-j threads] [-v] [file ...]\n"
+  "Exact sums of binary float and double data in native byte order,\n"
+  "printed rounded in every mode: zero, inf (away from zero), ninf,\n"
+  "pinf and nearest. Reads stdin without files. All files are summed\n"
+  "together.\n"
+  "  -l layout   fields of a record: f float, d double, x skipped byte,\n"
+  "              each with an optional repeat count, e.g. 2fd4x\n"
+  "              (default f)\n"
+  "  -j threads  number of worker threads (default: one per CPU)\n"
+  "  -v          print throughput to stderr\n";
+
+static const char *mode_names[5] = {"zero", "inf", "ninf", "pinf", "nearest"};
+
+typedef struct {
+  //! 'f' or 'd'
+  char type;
+  size_t offset;
+} column_t;
+
+typedef struct {
+  column_t col[MAXCOLS];
+  int cols;
+  size_t recsize;
+} layout_t;
+
+typedef union {
+  efac_register_t f;
+  efac_dregister_t d;
+} acc_t;
+
+typedef struct {
+  const layout_t *layout;
+  const uint8_t *data;
+  size_t records;
+  //! records per work item
+  size_t chunk;
+  //! next record to hand out, shared by all workers
+  size_t next;
+  //! read ahead with madvise, the data is a file mapping
+  int mapped;
+} job_t;
+
+typedef struct {
+  pthread_t thread;
+  job_t *job;
+  //! accumulators of this thread, one per column, kept across jobs
+  acc_t *acc;
+} worker_t;
+
+static int parse_layout(const char *s, layout_t *l) {
+  l->cols = 0;
+  l->recsize = 0;
+  while (*s) {
+    char *end;
+    long n = strtol(s, &end, 10);
+    if (end == s)
+      n = 1;
+    if (n <= 0 || n > 1 << 20)
+      return 0;
+    s = end;
+    if (*s == 'x') {
+      l->recsize += n;
+    } else if (*s == 'f' || *s == 'd') {
+      for (; n; n--) {
+        if (l->cols == MAXCOLS)
+          return 0;
+        l->col[l->cols].type = *s;
+        l->col[l->cols++].offset = l->recsize;
+        l->recsize += *s == 'f' ? sizeof(float) : sizeof(double);
+      }
+    } else
+      return 0;
+    s++;
+  }
+  return l->cols > 0;
+}
+
+static void acc_clear(const layout_t *l, acc_t *acc) {
+  int c;
+  for (c = 0; c < l->cols; c++) {
+    if (l->col[c].type == 'f')
+      efac_reg_clear(&acc[c].f);
+    else
+      efac_dreg_clear(&acc[c].d);
+  }
+}
+
+static void acc_merge(const layout_t *l, acc_t *dst, acc_t *src) {
+  int c;
+  for (c = 0; c < l->cols; c++) {
+    if (l->col[c].type == 'f')
+      efac_reg_merge(&dst[c].f, &src[c].f);
+    else
+      efac_dreg_merge(&dst[c].d, &src[c].d);
+  }
+}
+
+/**
+ * Add cnt records. A single column without padding is added in place,
+ * otherwise the values of each column are copied out GATHER records at
+ * a time, so the records stay in L1 while all columns are done.
+ */
+static void add_records(const layout_t *l, acc_t *acc, const uint8_t *p,
+                        size_t cnt) {
+  union {
+    float f[GATHER];
+    double d[GATHER];
+  } buf;
+  size_t i, j, n;
+  int c;
+  if (l->cols == 1 && l->col[0].type == 'f' && l->recsize == sizeof(float)) {
+    efac_reg_add_values(&acc[0].f, (const float *)p, cnt, 0);
+    return;
+  }
+  if (l->cols == 1 && l->col[0].type == 'd' && l->recsize == sizeof(double)) {
+    efac_dreg_add_values(&acc[0].d, (const double *)p, cnt, 0);
+    return;
+  }
+  for (i = 0; i < cnt; i += n) {
+    n = cnt - i < GATHER ? cnt - i : GATHER;
+    for (c = 0; c < l->cols; c++) {
+      const uint8_t *src = p + i * l->recsize + l->col[c].offset;
+      if (l->col[c].type == 'f') {
+        for (j = 0; j < n; j++)
+          memcpy(&buf.f[j], src + j * l->recsize, sizeof(float));
+        efac_reg_add_values(&acc[c].f, buf.f, n, 0);
+      } else {
+        for (j = 0; j < n; j++)
+          memcpy(&buf.d[j], src + j * l->recsize, sizeof(double));
+        efac_dreg_add_values(&acc[c].d, buf.d, n, 0);
+      }
+    }
+  }
+}
+
+/**
+ * Worker: grab chunks until none are left. The sums are exact, so the
+ * order in which the workers take the chunks does not matter.
+ */
+static void *worker(void *arg) {
+  worker_t *w = arg;
+  job_t *job = w->job;
+  size_t recsize = job->layout->recsize;
+  long page = sysconf(_SC_PAGESIZE);
+  size_t ahead = AHEAD * job->chunk;
+  while (1) {
+    size_t start = __sync_fetch_and_add(&job->next, job->chunk);
+    size_t n;
+    if (start >= job->records)
+      break;
+    n = job->records - start < job->chunk ? job->records - start
+                                          : job->chunk;
+    // start reading the chunk that will be taken AHEAD chunks later,
+    // the earlier ones were requested by this or the other workers
+    if (job->mapped && start + ahead < job->records) {
+      size_t end = start + ahead + job->chunk;
+      uintptr_t lo = (uintptr_t)(job->data + (start + ahead) * recsize);
+      uintptr_t hi = (uintptr_t)(job->data +
+          (end < job->records ? end : job->records) * recsize);
+      lo &= ~(uintptr_t)(page - 1);
+      madvise((void *)lo, hi - lo, MADV_WILLNEED);
+    }
+    add_records(job->layout, w->acc, job->data + start * recsize, n);
+  }
+  return NULL;
+}
+
+static int start_job(worker_t *workers, int nthreads, job_t *job) {
+  int i;
+  for (i = 0; i < nthreads; i++) {
+    workers[i].job = job;
+    if (pthread_create(&workers[i].thread, NULL, worker, &workers[i])) {
+      // run the job with the threads we have
+      if (!i)
+        worker(&workers[0]);
+      return i;
+    }
+  }
+  return i;
+}
+
+static void finish_job(worker_t *workers, int started) {
+  int i;
+  for (i = 0; i < started; i++)
+    pthread_join(workers[i].thread, NULL);
+}
+
+static void init_job(job_t *job, const layout_t *l, const uint8_t *data,
+                     size_t records, int mapped) {
+  job->layout = l;
+  job->data = data;
+  job->records = records;
+  job->chunk = CHUNK / l->recsize ? CHUNK / l->recsize : 1;
+  job->next = 0;
+  job->mapped = mapped;
+}
+
+static void trailing(const char *name, size_t bytes) {
+  if (bytes)
+    fprintf(stderr, "efacsum: %s: trailing %zu bytes ignored\n", name, bytes);
+}
+
+/**
+ * Sum a regular file through a read-only mapping. MAP_POPULATE is not
+ * used as it would fault in all pages from this thread, instead the
+ * workers fault in their chunks in parallel and request readahead.
+ */
+static int sum_file(int fd, const char *name, size_t size,
+                    const layout_t *l, worker_t *workers, int nthreads) {
+  job_t job;
+  void *data;
+  if (!size)
+    return 1;
+  data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "efacsum: %s: %s\n", name, strerror(errno));
+    return 0;
+  }
+  madvise(data, size, MADV_SEQUENTIAL);
+  init_job(&job, l, data, size / l->recsize, 1);
+  madvise(data, job.chunk * l->recsize * AHEAD * nthreads < size ?
+          job.chunk * l->recsize * AHEAD * nthreads : size, MADV_WILLNEED);
+  finish_job(workers, start_job(workers, nthreads, &job));
+  munmap(data, size);
+  trailing(name, size % l->recsize);
+  return 1;
+}
+
+static ssize_t read_full(int fd, uint8_t *buf, size_t len) {
+  size_t got = 0;
+  while (got < len) {
+    ssize_t n = read(fd, buf + got, len - got);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    if (!n)
+      break;
+    got += n;
+  }
+  return got;
+}
+
+/**
+ * Sum a pipe or other stream, reading the next buffer while the workers
+ * sum the previous one.
+ */
+static int sum_stream(int fd, const char *name, const layout_t *l,
+                      worker_t *workers, int nthreads, size_t *total) {
+  size_t len = STREAMBUF / l->recsize * l->recsize;
+  uint8_t *buf[2];
+  job_t job;
+  ssize_t got;
+  int started = 0;
+  int cur = 0;
+  int ok = 1;
+  if (!len)
+    len = l->recsize;
+  buf[0] = malloc(len);
+  buf[1] = malloc(len);
+  if (!buf[0] || !buf[1]) {
+    fprintf(stderr, "efacsum: out of memory\n");
+    free(buf[0]);
+    free(buf[1]);
+    return 0;
+  }
+  got = read_full(fd, buf[cur], len);
+  while (got > 0) {
+    init_job(&job, l, buf[cur], got / l->recsize, 0);
+    started = start_job(workers, nthreads, &job);
+    *total += got;
+    if ((size_t)got < len) {
+      trailing(name, got % l->recsize);
+      got = 0;
+    } else {
+      cur ^= 1;
+      got = read_full(fd, buf[cur], len);
+    }
+    finish_job(workers, started);
+  }
+  if (got < 0) {
+    fprintf(stderr, "efacsum: %s: %s\n", name, strerror(errno));
+    ok = 0;
+  }
+  free(buf[0]);
+  free(buf[1]);
+  return ok;
+}
+
+static int sum_fd(int fd, const char *name, const layout_t *l,
+                  worker_t *workers, int nthreads, size_t *total) {
+  struct stat st;
+  if (fstat(fd, &st)) {
+    fprintf(stderr, "efacsum: %s: %s\n", name, strerror(errno));
+    return 0;
+  }
+  if (!S_ISREG(st.st_mode))
+    return sum_stream(fd, name, l, workers, nthreads, total);
+  *total += st.st_size;
+  return sum_file(fd, name, st.st_size, l, workers, nthreads);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+  static worker_t workers[MAXTHREADS];
+  layout_t layout;
+  acc_t *accs;
+  size_t total = 0;
+  int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  int verbose = 0;
+  int ok = 1;
+  int opt, i, c, mode;
+  double t;
+  parse_layout("f", &layout);
+  while ((opt = getopt(argc, argv, "l:j:vh")) != -1) {
+    switch (opt) {
+    case 'l':
+      if (!parse_layout(optarg, &layout)) {
+        fprintf(stderr, "efacsum: invalid layout '%s'\n", optarg);
+        return 2;
+      }
+      break;
+    case 'j':
+      nthreads = atoi(optarg);
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    default:
+      fputs(help_text, opt == 'h' ? stdout : stderr);
+      return opt == 'h' ? 0 : 2;
+    }
+  }
+  if (nthreads <= 0)
+    nthreads = 1;
+  if (nthreads > MAXTHREADS)
+    nthreads = MAXTHREADS;
+  if (!efac_init()) {
+    fprintf(stderr, "efacsum: init failed!\n");
+    return 1;
+  }
+  // one set of accumulators per worker, the last one for the result
+  accs = malloc((size_t)(nthreads + 1) * layout.cols * sizeof(*accs));
+  if (!accs) {
+    fprintf(stderr, "efacsum: out of memory\n");
+    return 1;
+  }
+  for (i = 0; i <= nthreads; i++) {
+    acc_clear(&layout, accs + i * layout.cols);
+    if (i < nthreads)
+      workers[i].acc = accs + i * layout.cols;
+  }
+  t = now();
+  if (optind == argc)
+    ok = sum_fd(0, "stdin", &layout, workers, nthreads, &total);
+  for (i = optind; i < argc; i++) {
+    int fd = !strcmp(argv[i], "-") ? 0 : open(argv[i], O_RDONLY);
+    if (fd < 0) {
+      fprintf(stderr, "efacsum: %s: %s\n", argv[i], strerror(errno));
+      ok = 0;
+      continue;
+    }
+    ok &= sum_fd(fd, argv[i], &layout, workers, nthreads, &total);
+    if (fd)
+      close(fd);
+  }
+  for (i = 0; i < nthreads; i++)
+    acc_merge(&layout, accs + nthreads * layout.cols, workers[i].acc);
+  t = now() - t;
+  for (c = 0; c < layout.cols; c++) {
+    acc_t *acc = &accs[nthreads * layout.cols + c];
+    printf("%d %s", c, layout.col[c].type == 'f' ? "float" : "double");
+    for (mode = 0; mode < 5; mode++) {
+      if (layout.col[c].type == 'f')
+        printf(" %s %.9g", mode_names[mode], efac_reg_read(&acc->f, mode));
+      else
+        printf(" %s %.17g", mode_names[mode], efac_dreg_read(&acc->d, mode));
+    }
+    printf("\n");
+  }
+  if (verbose)
+    fprintf(stderr, "%zu bytes, %zu records in %.3f s, %.2f GB/s\n", total,
+            total / layout.recsize, t, total / t * 1e-9);
+  free(accs);
+  return !ok;
+}
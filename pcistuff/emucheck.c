@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libefac.h"
+#include "libefacemu.h"
+
+#define TRIALS 50
+#define OPS 2000
+//! software register used as reference, not touched through the device
+#define REF 7
+//! device register beyond the first eight, every other trial uses it
+#define HIGH (EFAC_REGCNT - 1)
+
+/*
+ * libsoftefac functions under other names, the usual ones are the
+ * inline device accessors from libefac.h here.
+ */
+void soft_add(int reg, float val) __asm__("efac_add");
+void soft_sub(int reg, float val) __asm__("efac_sub");
+void soft_clear(int reg) __asm__("efac_clear");
+void soft_add_array(int reg, const float *vals, size_t cnt)
+  __asm__("efac_soft_add_array");
+void soft_sub_array(int reg, const float *vals, size_t cnt)
+  __asm__("efac_soft_sub_array");
+void soft_save(int reg, uint32_t buf[512]) __asm__("efac_soft_save");
+size_t soft_serialize(int reg, uint8_t *buf) __asm__("efac_soft_serialize");
+void soft_add_fixed(int reg, int64_t val, int scale_bits)
+  __asm__("efac_soft_add_fixed");
+void soft_add_fixed_array(int reg, const int64_t *vals, size_t cnt,
+                          int scale_bits) __asm__("efac_soft_add_fixed_array");
+int soft_read_fixed(int reg, int scale_bits, int64_t *val)
+  __asm__("efac_soft_read_fixed");
+float soft_read_zero(int reg) __asm__("efac_read_round_zero");
+float soft_read_inf(int reg) __asm__("efac_read_round_inf");
+float soft_read_ninf(int reg) __asm__("efac_read_round_ninf");
+float soft_read_pinf(int reg) __asm__("efac_read_round_pinf");
+float soft_read_nearest(int reg) __asm__("efac_read_round_nearest");
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t flt2int(float x) {
+  union {
+    float f;
+    uint32_t i;
+  } v;
+  v.f = x;
+  return v.i;
+}
+
+static float int2flt(uint32_t x) {
+  union {
+    float f;
+    uint32_t i;
+  } v;
+  v.i = x;
+  return v.f;
+}
+
+static float rand_float(void) {
+  uint32_t r = (uint32_t)rand() << 16 ^ rand();
+  if ((r & 0x7f800000) == 0x7f800000)
+    r &= ~0x00800000;
+  // mostly a narrow range so that values cancel and carry
+  if (r & 0x100)
+    r = (r & 0x807fffff) | (120 + r % 16) << 23;
+  return int2flt(r);
+}
+
+static int check(int trial, int reg) {
+  static uint32_t buf[512], ref[512];
+  uint8_t ser[EFAC_SERIAL_MAX], sref[EFAC_SERIAL_MAX];
+  size_t len;
+  float (*const dev[])(int) = {efac_read_round_zero, efac_read_round_inf,
+                               efac_read_round_ninf, efac_read_round_pinf,
+                               efac_read_round_nearest};
+  float (*const soft[])(int) = {soft_read_zero, soft_read_inf, soft_read_ninf,
+                                soft_read_pinf, soft_read_nearest};
+  int bad = 0;
+  int m;
+  efac_save(reg, buf);
+  soft_save(REF, ref);
+  if (memcmp(buf, ref, sizeof(buf))) {
+    printf("trial %i: saved state differs\n", trial);
+    bad++;
+  }
+  for (m = 0; m < 5; m++) {
+    if (flt2int(dev[m](reg)) != flt2int(soft[m](REF))) {
+      printf("trial %i: read mode %i differs: %e %e\n", trial, m, dev[m](reg),
+             soft[m](REF));
+      bad++;
+    }
+  }
+  for (m = EFAC_FIXED_MIN; m <= EFAC_FIXED_MAX; m += 13) {
+    int64_t v, sv;
+    int r = efac_read_fixed(reg, m, &v);
+    if (r != soft_read_fixed(REF, m, &sv) || v != sv) {
+      printf("trial %i: fixed read with scale %i differs\n", trial, m);
+      bad++;
+    }
+  }
+  if (efac_is_negative(reg) != (int)(ref[0] & 1) ||
+      efac_is_overflow(reg) != (int)(ref[0] >> 1 & 1) ||
+      efac_is_zero(reg) != (int)(ref[0] >> 2 & 1)) {
+    printf("trial %i: flags differ\n", trial);
+    bad++;
+  }
+  efac_restore(1, buf);
+  efac_save(1, ref);
+  if (memcmp(buf, ref, sizeof(buf))) {
+    printf("trial %i: restore did not round-trip\n", trial);
+    bad++;
+  }
+  len = efac_serialize(reg, ser);
+  if (len != soft_serialize(REF, sref) || memcmp(ser, sref, len)) {
+    printf("trial %i: serialized state differs\n", trial);
+    bad++;
+  }
+  if (efac_deserialize(1, ser, len) != len) {
+    printf("trial %i: deserialize failed\n", trial);
+    bad++;
+  }
+  efac_save(1, ref);
+  if (memcmp(buf, ref, sizeof(buf))) {
+    printf("trial %i: deserialize did not round-trip\n", trial);
+    bad++;
+  }
+  return bad;
+}
+
+int main(void) {
+  int trial, i;
+  int bad = 0;
+  int16_t ro, wo;
+  unsigned long reads, writes, reads0, writes0;
+  static float arr[1 << 12];
+  double t;
+  if (!efac_init()) {
+    printf("init failed!\n");
+    return 1;
+  }
+  for (trial = 0; trial < TRIALS; trial++) {
+    int reg = trial & 1 ? HIGH : 0;
+    efac_clear(reg);
+    soft_clear(REF);
+    for (i = 0; i < OPS; i++) {
+      float v[40];
+      int64_t iv[40];
+      int j;
+      int n = rand() % 40;
+      int scale = EFAC_FIXED_MIN + rand() % (EFAC_FIXED_MAX - EFAC_FIXED_MIN);
+      for (j = 0; j < 40; j++) {
+        v[j] = rand_float();
+        iv[j] = (int64_t)((uint64_t)rand() << 42 ^ (uint64_t)rand() << 21 ^
+                          rand()) >> rand() % 64;
+      }
+      // the last trial checks the overflow flag
+      if (trial == TRIALS - 1 && i == OPS / 2)
+        v[0] = 1.0f / 0.0f;
+      switch (rand() % 8) {
+      case 0:
+        efac_add(reg, v[0]);
+        soft_add(REF, v[0]);
+        break;
+      case 1:
+        efac_sub(reg, v[0]);
+        soft_sub(REF, v[0]);
+        break;
+      case 2:
+        efac_add4(reg, v[0], v[1], v[2], v[3]);
+        for (j = 0; j < 4; j++)
+          soft_add(REF, v[j]);
+        break;
+      case 3:
+        efac_sub4(reg, v[0], v[1], v[2], v[3]);
+        for (j = 0; j < 4; j++)
+          soft_sub(REF, v[j]);
+        break;
+      case 4:
+        efac_add_array(reg, v, n);
+        soft_add_array(REF, v, n);
+        break;
+      case 5:
+        efac_sub_array(reg, v, n);
+        soft_sub_array(REF, v, n);
+        break;
+      case 6:
+        efac_add_fixed(reg, iv[0], scale);
+        soft_add_fixed(REF, iv[0], scale);
+        break;
+      default:
+        efac_add_fixed_array(reg, iv, n, scale);
+        soft_add_fixed_array(REF, iv, n, scale);
+        break;
+      }
+    }
+    bad += check(trial, reg);
+  }
+  efac_clear_overflow(HIGH);
+  if (efac_is_overflow(HIGH)) {
+    printf("overflow flag not cleared\n");
+    bad++;
+  }
+  efac_set_offsets(2, -3, 5);
+  efac_get_offsets(2, &ro, &wo);
+  if (ro != -3 || wo != 5) {
+    printf("offsets differ: %i %i\n", ro, wo);
+    bad++;
+  }
+  // scaled adds and reads of a register beyond the first eight
+  efac_clear(HIGH);
+  efac_set_offsets(HIGH, -3, 5);
+  efac_add(HIGH, 1.0f);
+  efac_get_offsets(HIGH, &ro, &wo);
+  if (ro != -3 || wo != 5 || efac_read_round_nearest(HIGH) != 4.0f) {
+    printf("register %i differs: offsets %i %i, read %e\n", HIGH, ro, wo,
+           efac_read_round_nearest(HIGH));
+    bad++;
+  }
+  efac_set_offsets(HIGH, 0, 0);
+  printf("%i trials, %i mismatches\n", TRIALS, bad);
+
+  // device accesses per value for the configured EFAC_WRITE/EFAC_BARRIER
+  efac_clear(0);
+  efac_emu_counts(&reads0, &writes0);
+  t = now();
+  for (i = 0; i < 1 << 16; i++)
+    efac_add(0, i);
+  t = now() - t;
+  efac_emu_counts(&reads, &writes);
+  printf("efac_add:       %.3f reads %.3f writes per value, %.0f ns emulated\n",
+         (reads - reads0) / 65536.0, (writes - writes0) / 65536.0,
+         t / 65536 * 1e9);
+  reads0 = reads;
+  writes0 = writes;
+  t = now();
+  for (i = 0; i < 1 << 16; i += 4)
+    efac_add4(0, i, i + 1, i + 2, i + 3);
+  t = now() - t;
+  efac_emu_counts(&reads, &writes);
+  printf("efac_add4:      %.3f reads %.3f writes per value, %.0f ns emulated\n",
+         (reads - reads0) / 65536.0, (writes - writes0) / 65536.0,
+         t / 65536 * 1e9);
+  for (i = 0; i < 1 << 12; i++)
+    arr[i] = i;
+  reads0 = reads;
+  writes0 = writes;
+  t = now();
+  for (i = 0; i < 1 << 16; i += 1 << 12)
+    efac_add_array(0, arr, 1 << 12);
+  t = now() - t;
+  efac_emu_counts(&reads, &writes);
+  printf("efac_add_array: %.3f reads %.3f writes per value, %.0f ns emulated\n",
+         (reads - reads0) / 65536.0, (writes - writes0) / 65536.0,
+         t / 65536 * 1e9);
+  return bad != 0;
+}
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "libsoftefac.h"
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static float int2flt(uint32_t x) {
+  union {
+    float f;
+    uint32_t i;
+  } v;
+  v.i = x;
+  return v.f;
+}
+
+static uint32_t rand32(void) {
+  return (uint32_t)rand() << 16 ^ rand();
+}
+
+/*
+ * Every key gets pairs of values x and -x, spread over the values in
+ * random order, and some 1.0. The exact sum of a key is the number of
+ * ones, which a naive float or double sum gets wrong for wide ranges.
+ */
+static size_t run(const char *name, size_t keycnt, size_t cnt, int wide) {
+  uint64_t *keys = malloc(cnt * sizeof(*keys));
+  float *vals = malloc(cnt * sizeof(*vals));
+  uint64_t *outkeys = malloc(keycnt * sizeof(*outkeys));
+  float *sums = malloc(keycnt * sizeof(*sums));
+  unsigned *ones = calloc(keycnt, sizeof(*ones));
+  efac_group_t *g = efac_group_create(0);
+  size_t i, bad = 0;
+  double t;
+  if (!keys || !vals || !outkeys || !sums || !ones || !g) {
+    printf("out of memory\n");
+    exit(1);
+  }
+  for (i = 0; i < cnt; i++) {
+    size_t k = rand32() % keycnt;
+    uint32_t exp = wide ? 1 + rand32() % 253 : 120 + rand32() % 16;
+    // sparse keys, not just 0..keycnt-1
+    keys[i] = k * 0x100000001ULL;
+    if (i + 1 == cnt || rand32() % 4 == 0) {
+      vals[i] = 1.0f;
+      ones[k]++;
+      continue;
+    }
+    keys[i + 1] = keys[i];
+    vals[i] = int2flt((rand32() & 0x807fffff) | exp << 23);
+    vals[i + 1] = -vals[i];
+    i++;
+  }
+  // mix the pairs up, the minus values can come before the plus ones
+  for (i = cnt - 1; i > 0; i--) {
+    size_t j = rand32() % (i + 1);
+    uint64_t k = keys[i];
+    float v = vals[i];
+    keys[i] = keys[j];
+    vals[i] = vals[j];
+    keys[j] = k;
+    vals[j] = v;
+  }
+  t = now();
+  if (!efac_group_add(g, keys, vals, cnt)) {
+    printf("efac_group_add failed\n");
+    exit(1);
+  }
+  t = now() - t;
+  efac_group_read(g, outkeys, sums);
+  for (i = 0; i < efac_group_count(g); i++) {
+    if (sums[i] != ones[outkeys[i] / 0x100000001ULL])
+      bad++;
+  }
+  printf("%s: %zu keys, %.2f ns per value, %.1f bytes per key, "
+         "%zu mismatches\n", name, efac_group_count(g), t / cnt * 1e9,
+         (double)efac_group_bytes(g) / efac_group_count(g), bad);
+  efac_group_free(g);
+  free(keys);
+  free(vals);
+  free(outkeys);
+  free(sums);
+  free(ones);
+  return bad;
+}
+
+int main(int argc, char *argv[]) {
+  size_t keycnt = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+  size_t cnt = argc > 2 ? strtoul(argv[2], NULL, 0) : 10 * keycnt;
+  if (!efac_init()) {
+    printf("init failed!\n");
+    return 1;
+  }
+  return run("narrow", keycnt, cnt, 0) + run("full", keycnt, cnt, 1) != 0;
+}
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libsoftefac.h"
+
+#define COUNT (1 << 26)
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static float int2flt(uint32_t x) {
+  union {
+    float f;
+    uint32_t i;
+  } v;
+  v.i = x;
+  return v.f;
+}
+
+//! exact, every half is a float
+static float half2flt(uint16_t h) {
+  int exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  if (exp == 0x1f)
+    return int2flt(sign | 0x7f800000 | mant << 13);
+  if (!exp) {
+    float v = mant * (1.0f / (1 << 24));
+    return sign ? -v : v;
+  }
+  return int2flt(sign | (exp + 112) << 23 | mant << 13);
+}
+
+/*
+ * Sum random halfs and bfloat16s with the compact registers and compare
+ * every rounding mode with a float register fed the same values.
+ */
+static int run(const char *name, uint16_t *vals, int bf16) {
+  efac_reg16_t r, tail;
+  float ref[5], out[5];
+  double t;
+  int i;
+  efac_clear(0);
+  for (i = 0; i < COUNT; i++)
+    efac_add(0, bf16 ? int2flt((uint32_t)vals[i] << 16) : half2flt(vals[i]));
+  efac_read_all(0, ref);
+  efac_reg16_clear(&r);
+  efac_reg16_clear(&tail);
+  t = now();
+  if (bf16)
+    efac_reg16_add_bf16_array(&r, vals, COUNT - 1000);
+  else
+    efac_reg16_add_half_array(&r, vals, COUNT - 1000);
+  t = now() - t;
+  // the single value functions and merging as well
+  for (i = COUNT - 1000; i < COUNT; i++) {
+    if (bf16)
+      efac_reg16_add_bf16(&tail, vals[i]);
+    else
+      efac_reg16_add_half(&tail, vals[i]);
+  }
+  efac_reg16_merge(&r, &tail);
+  efac_reg16_read_all(&r, out);
+  printf("%s: %.9e, %.3f ns/value, %.2f Gvalues/s, %s\n", name, out[4],
+         t * 1e9 / COUNT, COUNT / t * 1e-9,
+         memcmp(ref, out, sizeof(out)) ? "MISMATCH" : "identical");
+  return !!memcmp(ref, out, sizeof(out));
+}
+
+int main(void) {
+  uint16_t *vals = malloc(COUNT * sizeof(*vals));
+  int bad = 0;
+  int i;
+  if (!vals || !efac_init()) {
+    printf("init failed!\n");
+    return 1;
+  }
+  // finite values, no Inf or NaN
+  for (i = 0; i < COUNT; i++)
+    vals[i] = rand() & 0xfbff;
+  bad += run("half", vals, 0);
+  for (i = 0; i < COUNT; i++)
+    vals[i] = rand() & 0xff7f;
+  bad += run("bfloat16", vals, 1);
+  // gradients: small values around 2^-10
+  for (i = 0; i < COUNT; i++)
+    vals[i] = (rand() & 0x807f) | (110 + rand() % 12) << 7;
+  bad += run("bfloat16 narrow", vals, 1);
+  free(vals);
+  return bad != 0;
+}
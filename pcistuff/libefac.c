@@ -1,4 +1,5 @@
 #include <inttypes.h>
+#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -7,7 +8,11 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#ifdef EFAC_EMULATE
+#include "libefacemu.h"
+#else
 #include <pci/pci.h>
+#endif
 #include "libefac.h"
 
 //! PCI vendor ID for our device
@@ -20,6 +25,8 @@
 #define dbgprintf(...)
 #endif
 
+#ifndef EFAC_EMULATE
+
 /**
  * Does a pci scan to find our device
  * \param map_base [out] base address of the PCI memory range of the device
@@ -79,16 +86,31 @@ static void set_mtrr(off_t base, size_t size, char *mode) {
   write(fd, buffer, strlen(buffer));
   close(fd);
 }
+#endif
 
-#define REGCNT 16
+#define REGCNT EFAC_REGCNT
 #define REGSZ 4096
 #define EFAC_ALIGNED(n, t, v) t v __attribute__((aligned(n)))
+//! floats per 64 byte line
+#define LINE 16
+//! add lines per register, words with address bit 6 set subtract
+#define LINES 16
+//! word index of block 0
+#define BLOCKPOS 757
+//! values summed on the CPU per add in efac_add_fixed_array
+#define FIXEDCHUNK (1 << 16)
 
 EFAC_ALIGNED(REGSZ, volatile uint8_t, efac_regs[REGCNT * REGSZ]);
-int efac_idx;
+__thread int efac_idx[REGCNT];
 
 int efac_init(void) {
   int i;
+#ifdef EFAC_EMULATE
+  if (!efac_emu_init(efac_regs, REGCNT * REGSZ)) {
+    dbgprintf("device emulation setup failed\n");
+    return 0;
+  }
+#else
   size_t map_size = 0;
   off_t map_base = 0;
   volatile uint8_t *mapped;
@@ -108,6 +130,7 @@ int efac_init(void) {
   }
   dbgprintf("setting MTRR (check /proc/mtrr if it worked)\n");
 //  set_mtrr(map_base, map_size, "write-combining");
+#endif
   for (i = 0; i < REGCNT; i++) {
     efac_clear(i);
     efac_set_offsets(i, 0, 0);
@@ -134,3 +157,183 @@ void efac_restore(int reg, const uint32_t buf[512]) {
       EFAC_BARRIER(regb[512 + i]);
   }
 }
+
+size_t efac_serialize(int reg, uint8_t *buf) {
+  volatile uint32_t *regb = (volatile uint32_t *)&efac_regs[reg * REGSZ];
+  uint32_t blocks[EFAC_SERIAL_BLOCKS];
+  uint32_t flags, ofs;
+  int i;
+  EFAC_BARRIER(regb[512]);
+  flags = regb[512];
+  ofs = regb[513];
+  for (i = 0; i < EFAC_SERIAL_BLOCKS; i++) {
+    if (!i || !((BLOCKPOS + i) & 7))
+      EFAC_BARRIER(regb[BLOCKPOS + i]);
+    blocks[i] = regb[BLOCKPOS + i];
+  }
+  return efac_encode(buf, flags, ofs >> 16, ofs, blocks);
+}
+
+size_t efac_deserialize(int reg, const uint8_t *buf, size_t len) {
+  volatile uint32_t *regb = (volatile uint32_t *)&efac_regs[reg * REGSZ];
+  uint32_t blocks[EFAC_SERIAL_BLOCKS];
+  uint32_t flags;
+  int16_t rofs, wofs;
+  int i;
+  size_t used = efac_decode(buf, len, &flags, &rofs, &wofs, blocks);
+  if (!used)
+    return 0;
+  efac_clear(reg);
+  // bits 17 and 16 enable writing the overflow and sign flags
+  regb[512] = 0x00030000 | flags;
+  EFAC_BARRIER(regb[512]);
+  regb[513] = (uint32_t)rofs << 16 | (uint16_t)wofs;
+  EFAC_BARRIER(regb[513]);
+  // flush each line once its last word is written
+  for (i = 0; i < EFAC_SERIAL_BLOCKS; i++) {
+    regb[BLOCKPOS + i] = blocks[i];
+    if (!((BLOCKPOS + i + 1) & 7) || i == EFAC_SERIAL_BLOCKS - 1)
+      EFAC_BARRIER(regb[BLOCKPOS + i]);
+  }
+  return used;
+}
+
+size_t efac_serialize_array(int reg, int cnt, uint8_t *buf) {
+  size_t len = 0;
+  int i;
+  for (i = 0; i < cnt; i++)
+    len += efac_serialize(reg + i, buf + len);
+  return len;
+}
+
+size_t efac_deserialize_array(int reg, int cnt, const uint8_t *buf,
+                              size_t len) {
+  size_t used = 0;
+  int i;
+  for (i = 0; i < cnt; i++) {
+    size_t n = efac_deserialize(reg + i, buf + used, len - used);
+    if (!n)
+      return 0;
+    used += n;
+  }
+  return used;
+}
+
+/**
+ * Add v * 2^-scale_bits as four float adds of 24 bit pieces, which are
+ * all exact for |v| < 2^79 and scale_bits in the EFAC_FIXED range.
+ */
+static void add_fixed(int reg, __int128 v, int scale_bits) {
+  float p[4];
+  int i;
+  for (i = 0; i < 3; i++)
+    p[i] = ldexpf((int32_t)(v >> 24 * i) & 0xffffff, 24 * i - scale_bits);
+  p[3] = ldexpf((int32_t)(v >> 72), 72 - scale_bits);
+  efac_add4(reg, p[0], p[1], p[2], p[3]);
+}
+
+void efac_add_fixed(int reg, int64_t val, int scale_bits) {
+  if (scale_bits < EFAC_FIXED_MIN || scale_bits > EFAC_FIXED_MAX) {
+    efac_add(reg, 1.0f / 0.0f);
+    return;
+  }
+  add_fixed(reg, val, scale_bits);
+}
+
+void efac_add_int64(int reg, int64_t val) {
+  add_fixed(reg, val, 0);
+}
+
+void efac_add_fixed_array(int reg, const int64_t *vals, size_t cnt,
+                          int scale_bits) {
+  size_t i, j;
+  if (scale_bits < EFAC_FIXED_MIN || scale_bits > EFAC_FIXED_MAX) {
+    efac_add(reg, 1.0f / 0.0f);
+    return;
+  }
+  // sums of 2^16 values are below 2^79, one add4 for each
+  for (i = 0; i < cnt; i += FIXEDCHUNK) {
+    __int128 sum = 0;
+    size_t n = cnt - i < FIXEDCHUNK ? cnt - i : FIXEDCHUNK;
+    for (j = 0; j < n; j++)
+      sum += vals[i + j];
+    add_fixed(reg, sum, scale_bits);
+  }
+}
+
+void efac_add_int64_array(int reg, const int64_t *vals, size_t cnt) {
+  efac_add_fixed_array(reg, vals, cnt, 0);
+}
+
+int efac_read_fixed(int reg, int scale_bits, int64_t *val) {
+  volatile uint32_t *regb = (volatile uint32_t *)&efac_regs[reg * REGSZ];
+  uint32_t blocks[EFAC_FIXED_BLOCKS];
+  uint32_t flags;
+  int i;
+  if (scale_bits < EFAC_FIXED_MIN || scale_bits > EFAC_FIXED_MAX) {
+    *val = 0;
+    return 1;
+  }
+  EFAC_BARRIER(regb[512]);
+  flags = regb[512];
+  // the blocks below the value are not needed
+  i = (EFAC_FIXED_ONE - scale_bits) / 32;
+  EFAC_BARRIER(regb[BLOCKPOS + i]);
+  for (; i < EFAC_FIXED_BLOCKS; i++) {
+    if (!((BLOCKPOS + i) & 7))
+      EFAC_BARRIER(regb[BLOCKPOS + i]);
+    blocks[i] = regb[BLOCKPOS + i];
+  }
+  return efac_fixed_from_blocks(blocks, flags, scale_bits, val);
+}
+
+int efac_read_int64(int reg, int64_t *val) {
+  return efac_read_fixed(reg, 0, val);
+}
+
+/**
+ * Stream values to the float add or sub words of a register.
+ * Each line is written completely (padded with zeros, which the device
+ * ignores) so the write-combining buffers can send it as one transfer.
+ * Lines must not be written twice before an sfence, as the second write
+ * could be combined with the first one. Line 0 holds the words used by
+ * efac_add/efac_sub, which are not fenced, so the other 15 lines are
+ * used in turn.
+ * \param reg register to write to
+ * \param vals values to write
+ * \param cnt number of values
+ * \param sub 64 to subtract, 0 to add
+ */
+static void submit_array(int reg, const float *vals, size_t cnt, int sub) {
+  volatile uint32_t *regb = (volatile uint32_t *)&efac_regs[reg * REGSZ];
+  int line = 1;
+  while (cnt) {
+    // line l covers words 16 * (l & 3) + 128 * (l >> 2)
+    volatile uint32_t *dst = regb + LINE * (line & 3) + 128 * (line >> 2) + sub;
+    size_t n = cnt < LINE ? cnt : LINE;
+    size_t i;
+    for (i = 0; i < LINE; i++) {
+      union {
+        float f;
+        uint32_t i;
+      } v;
+      v.f = i < n ? vals[i] : 0;
+      asm("movnti %1, %0\n\t" : "=m"(dst[i]) : "r"(v.i));
+    }
+    vals += n;
+    cnt -= n;
+    if (++line == LINES) {
+      asm("sfence\n\t" ::: "memory");
+      line = 1;
+    }
+  }
+  asm("sfence\n\t" ::: "memory");
+}
+
+void efac_add_array(int reg, const float *vals, size_t cnt) {
+  submit_array(reg, vals, cnt, 0);
+}
+
+void efac_sub_array(int reg, const float *vals, size_t cnt) {
+  submit_array(reg, vals, cnt, 64);
+}
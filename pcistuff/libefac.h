@@ -2,16 +2,24 @@
 #define LIBEFAC_H
 
 #include <inttypes.h>
+#include <stddef.h>
+#include "efac_serial.h"
+#include "efac_fixed.h"
+
+//! number of registers
+#define EFAC_REGCNT 16
 
 //! used to suppress warnings about unused functions
 #define efac_unused __attribute__((unused))
-#if 0
+//! define EFAC_MFENCE_BARRIER to use mfence instead of clflush
+#ifdef EFAC_MFENCE_BARRIER
 #define EFAC_BARRIER(var) asm("mfence\n\t":::"memory")
 #else
 #define EFAC_BARRIER(var) asm("clflush %0\n\t"::"o"(var):"memory")
 #endif
 
-#if 1
+//! define EFAC_MOVNTI_WRITE to use non-temporal stores
+#ifndef EFAC_MOVNTI_WRITE
 #define EFAC_WRITE(var, val) (var) = (val)
 #else
 #define EFAC_WRITE(var, val) asm("movnti %1, %0\n\t" : "=o"(var) : "r"(val))
@@ -23,10 +31,11 @@
  */
 extern volatile uint8_t efac_regs[];
 /**
- * Counter to allow for write-combining single writes.
+ * Per thread and register counters to allow for write-combining single
+ * writes.
  * Do not use this directly in an application!
  */
-extern int efac_idx;
+extern __thread int efac_idx[EFAC_REGCNT];
 
 /**
  * Initialize the hardware and set every up.
@@ -48,6 +57,116 @@ void efac_save(int reg, uint32_t buf[512]);
  */
 void efac_restore(int reg, const uint32_t buf[512]);
 
+/**
+ * Save register state in the compact format of efac_serial.h,
+ * only reading the flags, offsets and blocks instead of all 512 words
+ * \param reg register to save from
+ * \param buf buffer of at least EFAC_SERIAL_MAX bytes
+ * \return number of bytes written
+ */
+size_t efac_serialize(int reg, uint8_t *buf);
+
+/**
+ * Restore register state saved by efac_serialize
+ * \param reg register to restore into
+ * \param buf serialized state
+ * \param len number of bytes available in buf
+ * \return number of bytes used, 0 if buf is not valid
+ */
+size_t efac_deserialize(int reg, const uint8_t *buf, size_t len);
+
+/**
+ * Serialize registers reg to reg + cnt - 1 back to back
+ * \param reg first register to save from
+ * \param cnt number of registers
+ * \param buf buffer of at least cnt * EFAC_SERIAL_MAX bytes
+ * \return number of bytes written
+ */
+size_t efac_serialize_array(int reg, int cnt, uint8_t *buf);
+
+/**
+ * Restore registers reg to reg + cnt - 1 saved by efac_serialize_array
+ * \param reg first register to restore into
+ * \param cnt number of registers
+ * \param buf serialized state
+ * \param len number of bytes available in buf
+ * \return number of bytes used, 0 if buf is not valid
+ */
+size_t efac_deserialize_array(int reg, int cnt, const uint8_t *buf,
+                              size_t len);
+
+/**
+ * Add an array of float values to a register.
+ * Writes whole 64 byte lines with non-temporal stores and only fences
+ * once per 15 lines, much faster than calling efac_add for each value.
+ * \param reg register to add to
+ * \param vals values to add
+ * \param cnt number of values
+ */
+void efac_add_array(int reg, const float *vals, size_t cnt);
+
+/**
+ * Subtract an array of float values from a register, see efac_add_array
+ * \param reg register to subtract from
+ * \param vals values to subtract
+ * \param cnt number of values
+ */
+void efac_sub_array(int reg, const float *vals, size_t cnt);
+
+/**
+ * Add an integer, exactly
+ * \param reg register to add to
+ * \param val value to add
+ */
+void efac_add_int64(int reg, int64_t val);
+
+/**
+ * Add a fixed-point value val * 2^-scale_bits, exactly.
+ * The device has no integer input, the value goes in as four floats,
+ * so the write offset scales it like any float.
+ * \param reg register to add to
+ * \param val value to add
+ * \param scale_bits number of fraction bits, EFAC_FIXED_MIN to
+ *        EFAC_FIXED_MAX, others set the overflow flag
+ */
+void efac_add_fixed(int reg, int64_t val, int scale_bits);
+
+/**
+ * Add an array of integers, summed on the CPU in 128 bit first
+ * \param reg register to add to
+ * \param vals values to add
+ * \param cnt number of values
+ */
+void efac_add_int64_array(int reg, const int64_t *vals, size_t cnt);
+
+/**
+ * Add an array of fixed-point values, see efac_add_fixed
+ * \param reg register to add to
+ * \param vals values to add
+ * \param cnt number of values
+ * \param scale_bits number of fraction bits
+ */
+void efac_add_fixed_array(int reg, const int64_t *vals, size_t cnt,
+                          int scale_bits);
+
+/**
+ * Read the integer part of a register, rounded towards -infinity
+ * \param reg register to read
+ * \param val [out] register value, its low 64 bits if it does not fit
+ * \return 0 if the value fits, 1 if not or the overflow flag is set
+ */
+int efac_read_int64(int reg, int64_t *val);
+
+/**
+ * Read a register as fixed-point value, see efac_read_int64
+ * \param reg register to read
+ * \param scale_bits number of fraction bits, EFAC_FIXED_MIN to
+ *        EFAC_FIXED_MAX
+ * \param val [out] register value * 2^scale_bits
+ * \return 0 if the value fits, 1 if not or the overflow flag is set
+ */
+int efac_read_fixed(int reg, int scale_bits, int64_t *val);
+
 /**
  * Check if register value is negative
  * \param reg register to check
@@ -138,9 +257,9 @@ static inline efac_unused void efac_get_offsets(int reg,
  */
 static inline efac_unused void efac_add(int reg, float val) {
   volatile float *regb = (volatile float *)&efac_regs[reg * 4096];
-  EFAC_WRITE(regb[efac_idx++], val);
-  efac_idx &= 7;
-  if (efac_idx)
+  EFAC_WRITE(regb[efac_idx[reg]++], val);
+  efac_idx[reg] &= 7;
+  if (efac_idx[reg])
     return;
   EFAC_BARRIER(regb[0]);
 }
@@ -152,9 +271,9 @@ static inline efac_unused void efac_add(int reg, float val) {
  */
 static inline efac_unused void efac_sub(int reg, float val) {
   volatile float *regb = (volatile float *)&efac_regs[reg * 4096];
-  EFAC_WRITE(regb[64 + efac_idx++], val);
-  efac_idx &= 7;
-  if (efac_idx)
+  EFAC_WRITE(regb[64 + efac_idx[reg]++], val);
+  efac_idx[reg] &= 7;
+  if (efac_idx[reg])
     return;
   EFAC_BARRIER(regb[64]);
 }
@@ -261,4 +380,31 @@ static inline efac_unused float efac_read_round_nearest(int reg) {
   return regb[4];
 }
 
+/**
+ * Read the value of a register in all rounding modes, with a single barrier
+ * \param reg register to read
+ * \param out [out] value rounded towards 0, away from 0, towards -infinity,
+ *            towards +infinity and to nearest
+ */
+static inline efac_unused void efac_read_all(int reg, float out[5]) {
+  volatile float *regb = (volatile float *)&efac_regs[reg * 4096];
+  int i;
+  EFAC_BARRIER(regb[0]);
+  for (i = 0; i < 5; i++)
+    out[i] = regb[i];
+}
+
+/**
+ * Read an interval enclosing the value of a register
+ * \param reg register to read
+ * \param lo [out] register value rounded towards -infinity
+ * \param hi [out] register value rounded towards +infinity
+ */
+static inline efac_unused void efac_read_interval(int reg, float *lo, float *hi) {
+  volatile float *regb = (volatile float *)&efac_regs[reg * 4096];
+  EFAC_BARRIER(regb[0]);
+  *lo = regb[2];
+  *hi = regb[3];
+}
+
 #endif /* LIBEFAC_H */
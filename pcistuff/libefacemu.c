@@ -0,0 +1,184 @@
+/*
+ * Device emulation for libefac, see libefacemu.h.
+ * Must be built and linked with a libsoftefac.c that was compiled with
+ * EMUFLAGS from the Makefile, which renames the functions libefac.c also
+ * has (efac_init, efac_save, ...) to efac_soft_* so they do not clash.
+ */
+#define _GNU_SOURCE
+#include <math.h>
+#include <signal.h>
+#include <string.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include "libsoftefac_int.h"
+#include "libefacemu.h"
+
+#define REGSZ 4096
+//! trap flag in EFLAGS, raises SIGTRAP after the next instruction
+#define EFLAGS_TF 0x100
+//! page fault error code bit for write accesses
+#define PF_WRITE 2
+
+static volatile uint8_t *emu_base;
+static size_t emu_size;
+//! word accessed by the instruction being single-stepped
+static volatile uint32_t *emu_word;
+static int emu_write_access;
+static int16_t read_offset[REGCNT];
+static int16_t write_offset[REGCNT];
+static unsigned long emu_reads, emu_writes;
+
+static float (*const read_funcs[])(int) = {
+  efac_read_round_zero, efac_read_round_inf, efac_read_round_ninf,
+  efac_read_round_pinf, efac_read_round_nearest};
+
+static uint32_t flt2int(float x) {
+  union {
+    float f;
+    uint32_t i;
+  } v;
+  v.f = x;
+  return v.i;
+}
+
+static float int2flt(uint32_t x) {
+  union {
+    float f;
+    uint32_t i;
+  } v;
+  v.i = x;
+  return v.f;
+}
+
+/**
+ * Value the device returns for a read
+ * \param reg register number
+ * \param w word index within the register page
+ */
+static uint32_t emu_read(int reg, int w) {
+  uint32_t buf[512];
+  if (reg >= REGCNT)
+    return 0;
+  if (w < 512) {
+    // address bits 2..0 select the rounding mode, bit 2 is nearest
+    float v = read_funcs[w & 4 ? 4 : w & 3](reg);
+    if (read_offset[reg])
+      v = ldexpf(v, read_offset[reg]);
+    return flt2int(v);
+  }
+  if (w == 513)
+    return (uint16_t)write_offset[reg] | (uint32_t)read_offset[reg] << 16;
+  efac_soft_save(reg, buf);
+  return buf[w - 512];
+}
+
+/**
+ * Perform a write the way the device does
+ * \param reg register number
+ * \param w word index within the register page
+ * \param v written value
+ */
+static void emu_write(int reg, int w, uint32_t v) {
+  uint32_t buf[512];
+  if (reg >= REGCNT)
+    return;
+  if (w < 512) {
+    float f = int2flt(v);
+    // Inf and NaN set the overflow flag unscaled
+    if (write_offset[reg] && isfinite(f))
+      f = ldexpf(f, write_offset[reg]);
+    if (w & 64)
+      efac_sub(reg, f);
+    else
+      efac_add(reg, f);
+    return;
+  }
+  if (w == 513) {
+    write_offset[reg] = v;
+    read_offset[reg] = v >> 16;
+    return;
+  }
+  if (w == 512 && (v & (1 << 18)) && (v & 4)) {
+    efac_clear(reg);
+    return;
+  }
+  efac_soft_save(reg, buf);
+  if (w == 512) {
+    // bits 17 and 16 enable writing the overflow and sign flags
+    if (v & (1 << 17))
+      buf[0] = (buf[0] & ~2) | (v & 2);
+    if (v & (1 << 16))
+      buf[0] = (buf[0] & ~1) | (v & 1);
+  } else
+    buf[w - 512] = v;
+  efac_soft_restore(reg, buf);
+}
+
+static void segv_handler(int sig, siginfo_t *info, void *ctx) {
+  ucontext_t *uc = ctx;
+  uintptr_t ofs = (uintptr_t)info->si_addr - (uintptr_t)emu_base;
+  volatile uint8_t *page;
+  int reg, w;
+  (void)sig;
+  if (ofs >= emu_size || emu_word) {
+    // not ours, crash as usual when the access is retried
+    signal(SIGSEGV, SIG_DFL);
+    return;
+  }
+  page = emu_base + (ofs & ~(uintptr_t)(REGSZ - 1));
+  reg = ofs / REGSZ;
+  w = (ofs % REGSZ) / 4;
+  emu_word = (volatile uint32_t *)page + w;
+  emu_write_access = !!(uc->uc_mcontext.gregs[REG_ERR] & PF_WRITE);
+  mprotect((void *)(uintptr_t)page, REGSZ, PROT_READ | PROT_WRITE);
+  if (!emu_write_access) {
+    *emu_word = emu_read(reg, w);
+    emu_reads++;
+  }
+  uc->uc_mcontext.gregs[REG_EFL] |= EFLAGS_TF;
+}
+
+static void trap_handler(int sig, siginfo_t *info, void *ctx) {
+  ucontext_t *uc = ctx;
+  uintptr_t ofs = (uintptr_t)emu_word - (uintptr_t)emu_base;
+  (void)sig;
+  (void)info;
+  if (!emu_word) {
+    signal(SIGTRAP, SIG_DFL);
+    raise(SIGTRAP);
+    return;
+  }
+  uc->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF;
+  if (emu_write_access) {
+    emu_write(ofs / REGSZ, (ofs % REGSZ) / 4, *emu_word);
+    emu_writes++;
+  }
+  mprotect((void *)((uintptr_t)emu_base + (ofs & ~(uintptr_t)(REGSZ - 1))), REGSZ,
+           PROT_NONE);
+  emu_word = NULL;
+}
+
+int efac_emu_init(volatile uint8_t *regs, size_t size) {
+  struct sigaction sa;
+  // every register page needs a software register behind it
+  if ((uintptr_t)regs % REGSZ || size % REGSZ || size / REGSZ > REGCNT)
+    return 0;
+  emu_base = regs;
+  emu_size = size;
+  efac_soft_init();
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_flags = SA_SIGINFO;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_sigaction = segv_handler;
+  if (sigaction(SIGSEGV, &sa, NULL))
+    return 0;
+  sa.sa_sigaction = trap_handler;
+  if (sigaction(SIGTRAP, &sa, NULL))
+    return 0;
+  return !mprotect((void *)(uintptr_t)regs, size, PROT_NONE);
+}
+
+void efac_emu_counts(unsigned long *reads, unsigned long *writes) {
+  *reads = emu_reads;
+  *writes = emu_writes;
+}
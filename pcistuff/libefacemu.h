@@ -0,0 +1,27 @@
+#ifndef LIBEFACEMU_H
+#define LIBEFACEMU_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/**
+ * Emulate the device register pages at regs, used by efac_init when
+ * libefac.c is built with EFAC_EMULATE.
+ * The pages are protected, every access traps and is single-stepped,
+ * the accumulation itself is done by libsoftefac.
+ * Only 32 bit accesses from a single thread are emulated correctly.
+ * \param regs page aligned start of the register pages
+ * \param size size of the register pages
+ * \return 0 on error or with more pages than libsoftefac has registers,
+ *         1 otherwise
+ */
+int efac_emu_init(volatile uint8_t *regs, size_t size);
+
+/**
+ * Get the number of emulated accesses since efac_emu_init
+ * \param reads [out] number of reads, including cache line flushes
+ * \param writes [out] number of writes
+ */
+void efac_emu_counts(unsigned long *reads, unsigned long *writes);
+
+#endif /* LIBEFACEMU_H */
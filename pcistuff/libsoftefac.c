@@ -1,49 +1,106 @@
+#include <float.h>
 #include <math.h>
 #include <inttypes.h>
-#include "libsoftefac.h"
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "libsoftefac_int.h"
 
-#define REGCNT 8
-#define REGSIZE 23
+//! number of interleaved bin sets, avoids store-forwarding stalls on runs of equal exponents
+#define BINSETS 4
+//! a bin can take 2^39 24 bit mantissas, fold well before that
+#define BINFOLD (1ULL << 32)
+//! below this many values setting up and folding the bins is not worth it
+#define BINMIN 256
+//! values between folds of the double block sums, keeps them below 2^62
+#define DBLOCKFOLD (1 << 30)
+//! products are 48 bit, so a bin only takes 2^15 of them
+#define DOTFOLD (1 << 14)
+//! efac_save buffer index of block 0, same layout as the hardware
+#define SAVEPOS 245
+//! the vector kernels reduce their 2^55 lane values after this many steps
+#define LANEFOLD 16
+//! the dot product kernel reduces its 2^55 lane values after this many steps
+#define DOTLANEFOLD 128
+//! gathered values per dot_array call for sparse rows
+#define DOTGATHER 4096
+//! values per block of efac_sum_adaptive, small enough to replay only the
+//! blocks that need it, large enough for the error bound per block
+#define ADAPTBLOCK 1024
+#ifdef EFAC_STATS
+#define STAT(preg, field, n) ((preg)->stats.field += (n))
+#else
+#define STAT(preg, field, n) ((void)0)
+#endif
 
-typedef struct {
-  uint32_t buffer[REGSIZE];
-  uint32_t allmask;
-  uint32_t allvalue;
-  uint32_t padding[32-REGSIZE-2];
-} register_t;
+static efac_register_t regs[REGCNT];
 
-static register_t regs[REGCNT];
+static void select_kernel(void);
+
+static efac_dregister_t dregs[REGCNT];
 
 int efac_init(void) {
   int i;
-  for (i = 0; i < REGCNT; i++)
+  select_kernel();
+  for (i = 0; i < REGCNT; i++) {
     efac_clear(i);
+    efac_clear_double(i);
+  }
   return 1;
 }
 
+efac_register_t *efac_get_register(int reg) {
+  return &regs[reg];
+}
+
+void efac_reg_clear(efac_register_t *preg) {
+  preg->allmask = -1;
+  preg->allvalue = 0;
+  preg->cached = 0;
+#ifdef EFAC_DEFERRED_CARRY
+  preg->pending = 0;
+  memset(preg->wide, 0, sizeof(preg->wide));
+#endif
+#ifdef EFAC_STATS
+  memset(&preg->stats, 0, sizeof(preg->stats));
+#endif
+}
+
 void efac_clear(int reg) {
-  regs[reg].allmask = -1;
-  regs[reg].allvalue = 0;
+  efac_reg_clear(&regs[reg]);
 }
 
-static uint32_t read(register_t *preg, int pos) {
+static uint32_t read(efac_register_t *preg, int pos) {
   uint32_t mask = 1 << pos;
   int32_t val = preg->allvalue << (31 - pos);
-  return preg->allmask & mask ? val >> 31 : preg->buffer[pos];
+  return preg->allmask & mask ? (uint32_t)(val >> 31) : preg->buffer[pos];
 }
 
-static int do_add(register_t *preg, int pos, uint32_t v) {
-  uint32_t oldval = read(preg, pos);
-  uint32_t newval = oldval + v;
+static void write(efac_register_t *preg, int pos, uint32_t val) {
   uint32_t mask = 1 << pos;
-  preg->buffer[pos] = newval;
-  if (newval && newval != -1) preg->allmask &= ~mask;
+  STAT(preg, transitions, !(preg->allmask & mask) == (val + 1 <= 1));
+  preg->buffer[pos] = val;
+  if (val && val != (uint32_t)-1) preg->allmask &= ~mask;
   else {
     preg->allmask |= mask;
-    if (newval) preg->allvalue |= mask;
+    if (val) preg->allvalue |= mask;
     else preg->allvalue &= ~mask;
   }
-  return newval < oldval;
+}
+
+/**
+ * Set the overflow flag, the register reads as Inf from now on.
+ */
+static void set_overflow(efac_register_t *preg) {
+  preg->allmask &= ~(~0u << REGSIZE);
+  STAT(preg, overflows, 1);
+}
+
+static int do_add(efac_register_t *preg, int pos, uint32_t v, int carry) {
+  uint32_t oldval = read(preg, pos);
+  uint32_t newval = oldval + v + carry;
+  write(preg, pos, newval);
+  return carry ? newval <= oldval : newval < oldval;
 }
 
 static uint8_t log2_8bit[256] = {
@@ -79,47 +136,158 @@ static int efac_log2(uint32_t v) {
   return log;
 }
 
-void efac_add(int reg, float val) {
+static int efac_log2_64(uint64_t v) {
+  return v >> 32 ? 32 + efac_log2(v >> 32) : efac_log2(v);
+}
+
+/**
+ * Count a carry that went from block from through block to.
+ */
+static void count_carry(efac_register_t *preg, int from, int to) {
+#ifdef EFAC_STATS
+  uint64_t len = to - from + 1;
+  int bin = len > 1 ? efac_log2(len - 1) + 1 : 0;
+  preg->stats.carries++;
+  preg->stats.carry_blocks += len;
+  if (len > preg->stats.carry_max)
+    preg->stats.carry_max = len;
+  preg->stats.carry_len[bin < EFAC_STATS_CARRY_BINS ? bin :
+                        EFAC_STATS_CARRY_BINS - 1]++;
+#else
+  (void)preg;
+  (void)from;
+  (void)to;
+#endif
+}
+
+/**
+ * Propagate a carry (1) or borrow (-1) into block pos and upwards.
+ * Uses allmask/allvalue to skip over all the sign-extension blocks
+ * that would just pass it on.
+ */
+static void do_carry(efac_register_t *preg, int pos, int carry) {
+  // the sign bit keeps counting after an overflow, like the blocks do
+  uint32_t mask = preg->allmask | 1u << REGSIZE;
+  uint32_t tmp = carry < 0 ? preg->allvalue | ~mask :
+                             preg->allvalue &  mask;
+  int from = pos;
+  preg->allvalue = tmp + (carry << pos);
+  tmp ^= preg->allvalue;
+  pos = efac_log2(tmp);
+  count_carry(preg, from, pos < REGSIZE ? pos : REGSIZE - 1);
+  if (pos >= REGSIZE) {
+    if (pos == REGSIZE)
+      set_overflow(preg);
+    return;
+  } else if (!pos)
+    return;
+  // the allvalue bit of the block that absorbs the carry was flipped
+  // above, restore it so do_add sees the old block value
+  preg->allvalue ^= 1 << pos;
+  do_add(preg, pos, carry, 0);
+}
+
+/**
+ * Add a signed 64 bit value to blocks pos and pos + 1.
+ */
+static void add64(efac_register_t *preg, int pos, int64_t v) {
+  int carry = do_add(preg, pos, v, 0);
+  carry = do_add(preg, pos + 1, v >> 32, carry);
+  if (carry == (v < 0))
+    return;
+  do_carry(preg, pos + 2, v < 0 ? -1 : 1);
+}
+
+/**
+ * Add v << shift to blocks pos to pos + 2, shift must be < 32.
+ */
+static void add_shifted(efac_register_t *preg, int pos, int64_t v, int shift) {
+  uint64_t lo = (uint64_t)v << shift;
+  int32_t hi = v >> (shift ? 64 - shift : 63);
+  int carry = do_add(preg, pos, lo, 0);
+  carry = do_add(preg, pos + 1, lo >> 32, carry);
+  carry = do_add(preg, pos + 2, hi, carry);
+  if (carry == (hi < 0))
+    return;
+  do_carry(preg, pos + 3, hi < 0 ? -1 : 1);
+}
+
+#ifdef EFAC_DEFERRED_CARRY
+/**
+ * Add the wide entries to the blocks.
+ */
+static void normalize(efac_register_t *preg) {
+  int i;
+  if (!preg->pending)
+    return;
+  STAT(preg, folds, 1);
+  for (i = 0; i < REGSIZE - 1; i++) {
+    if (preg->wide[i])
+      add64(preg, i, preg->wide[i]);
+    preg->wide[i] = 0;
+  }
+  preg->pending = 0;
+}
+
+void efac_reg_add(efac_register_t *preg, float val) {
+  union {
+    float f;
+    uint32_t i;
+  } v;
+  int32_t sign;
+  int exp;
+  int pos;
+  int64_t mant;
+  preg->cached = 0;
+  STAT(preg, adds, 1);
+  v.f = val;
+  sign = (int32_t)v.i >> 31;
+  exp = (v.i >> 23) & 0xff;
+  if (exp == 0xff) { // Inf/NaN
+    set_overflow(preg);
+    return;
+  }
+  mant = (v.i & 0x7fffff) | (exp ? 0x800000 : 0);
+  mant = (mant ^ sign) - sign;
+  exp |= !exp;
+  // same 25 bit scale as the frexpf based version below
+  mant <<= (exp & 31) + 1;
+  pos = (exp >> 5) + REGSIZE/2 - 4;
+  // each entry grows by less than 2^32 per call
+  preg->wide[pos] += (uint32_t)mant;
+  preg->wide[pos + 1] += mant >> 32;
+  if (++preg->pending == 0x7fffffff)
+    normalize(preg);
+}
+#else
+#define normalize(preg) ((void)(preg))
+
+void efac_reg_add(efac_register_t *preg, float val) {
   int exp = 0;
   int pos;
-  uint32_t tmp;
-  int carry;
-  register_t *preg = &regs[reg];
   int64_t mant = frexpf(val, &exp) * (1 << 25);
+  preg->cached = 0;
+  STAT(preg, adds, 1);
   if (val - val) { // Inf/NaN
-    preg->allmask &= ~(-1 << REGSIZE);
+    set_overflow(preg);
     return;
   }
   if (!mant) return;
   exp += 126;
   if (exp < 0) {
-    mant >>= exp;
+    mant >>= -exp;
     pos = 0;
   } else {
     pos = exp >> 5;
     mant <<= exp & 31;
   }
   pos += REGSIZE/2 - 4;
-  carry = do_add(preg, pos, mant);
-  pos++;
-  mant >>= 32;
-  carry = do_add(preg, pos, mant + carry);
-  if (!carry ^ (mant < 0))
-    return;
-  pos++;
-  carry = mant < 0 ? -1 : 1;
-  tmp = mant < 0 ? preg->allvalue | ~preg->allmask :
-                   preg->allvalue &  preg->allmask;
-  preg->allvalue = tmp + (carry << pos);
-  tmp ^= preg->allvalue;
-  pos = efac_log2(tmp);
-  if (pos >= REGSIZE) {
-    if (pos == REGSIZE)
-      preg->allmask &= ~(-1 << REGSIZE);
-    return;
-  } else if (!pos)
-    return;
-  do_add(preg, pos, carry);
+  add64(preg, pos, mant);
+}
+#endif
+
+void efac_add(int reg, float val) {
+  efac_reg_add(&regs[reg], val);
 }
 
 void efac_add4(int reg, float val1, float val2, float val3, float val4) {
@@ -129,7 +297,790 @@ void efac_add4(int reg, float val1, float val2, float val3, float val4) {
   efac_add(reg, val4);
 }
 
+/**
+ * Fold the per-exponent bins into the register.
+ * Bin 0 holds the denormals, they have the same scale as exponent 1.
+ */
+static void fold_bins(efac_register_t *preg, int64_t bins[BINSETS][256]) {
+  int exp, i;
+  STAT(preg, folds, 1);
+  for (exp = 0; exp < 255; exp++) {
+    int pos = (exp | !exp) >> 5;
+    int shift = (exp | !exp) & 31;
+    int64_t mant = 0;
+    for (i = 0; i < BINSETS; i++)
+      mant += bins[i][exp];
+    if (!mant) continue;
+    // mantissas were added as 24 bit values, efac_add uses 25 bits
+    add_shifted(preg, pos + REGSIZE/2 - 4, mant * 2, shift);
+  }
+}
+
+static void add_array(efac_register_t *preg, const float *vals, size_t cnt,
+                      uint32_t signflip) {
+  int64_t bins[BINSETS][256];
+  while (cnt) {
+    size_t i;
+    size_t n = cnt < BINFOLD ? cnt : BINFOLD;
+    int special = 0;
+    memset(bins, 0, sizeof(bins));
+    for (i = 0; i < n; i++) {
+      union {
+        float f;
+        uint32_t i;
+      } v;
+      int32_t sign;
+      int exp;
+      int32_t mant;
+      v.f = vals[i];
+      v.i ^= signflip;
+      sign = (int32_t)v.i >> 31;
+      exp = (v.i >> 23) & 0xff;
+      mant = (v.i & 0x7fffff) | (exp ? 0x800000 : 0);
+      bins[i & (BINSETS - 1)][exp] += (mant ^ sign) - sign;
+      special |= (exp + 1) >> 8;
+    }
+    if (special) // Inf/NaN
+      set_overflow(preg);
+    fold_bins(preg, bins);
+    vals += n;
+    cnt -= n;
+  }
+}
+
+/*
+ * Vector kernels for the array add. Instead of binning by exponent they
+ * turn each float into its 64 bit value relative to the start of its
+ * block, mant << (exp & 31), and add it to the accumulator of its block
+ * (exp >> 5), so the work per value does not depend on the input.
+ * The accumulators are reduced into wide[], holding signed 32 bit block
+ * sums, every LANEFOLD steps.
+ */
+
+/**
+ * Add the wide block sums to the register.
+ * wide[i] is at block i + REGSIZE/2 - 4, scaled like a 24 bit mantissa.
+ */
+static void fold_wide(efac_register_t *preg, int64_t wide[9]) {
+  int i;
+  STAT(preg, folds, 1);
+  for (i = 0; i < 9; i++)
+    if (wide[i])
+      add_shifted(preg, i + REGSIZE/2 - 4, wide[i], 1);
+}
+
+static void add_wide(int64_t wide[9], int64_t v, int pos) {
+  wide[pos] += (uint32_t)v;
+  wide[pos + 1] += v >> 32;
+}
+
+/**
+ * Scalar version of the vector kernels for the remaining values.
+ * \return 1 if there was an Inf or NaN
+ */
+static int add_wide_tail(int64_t wide[9], const float *vals, size_t cnt,
+                         uint32_t signflip) {
+  int special = 0;
+  size_t i;
+  for (i = 0; i < cnt; i++) {
+    union {
+      float f;
+      uint32_t i;
+    } v;
+    int64_t sign;
+    int exp;
+    int64_t mant;
+    v.f = vals[i];
+    v.i ^= signflip;
+    sign = -(int64_t)(v.i >> 31);
+    exp = (v.i >> 23) & 0xff;
+    if (exp == 0xff) {
+      special = 1;
+      continue;
+    }
+    mant = (v.i & 0x7fffff) | (exp ? 0x800000 : 0);
+    exp |= !exp;
+    add_wide(wide, ((mant << (exp & 31)) ^ sign) - sign, exp >> 5);
+  }
+  return special;
+}
+
+__attribute__((target("avx2")))
+static void add_array_avx2(efac_register_t *preg, const float *vals,
+                           size_t cnt, uint32_t signflip) {
+  const __m256i one = _mm256_set1_epi64x(1);
+  const __m256i flip = _mm256_set1_epi64x(signflip);
+  const __m256i expmask = _mm256_set1_epi64x(0xff);
+  const __m256i mantmask = _mm256_set1_epi64x(0x7fffff);
+  const __m256i implicit = _mm256_set1_epi64x(0x800000);
+  const __m256i specexp = _mm256_set1_epi64x(0xff);
+  while (cnt) {
+    int64_t wide[9] = {0};
+    size_t n = cnt < BINFOLD ? cnt : BINFOLD;
+    size_t i = 0;
+    int special = 0;
+    while (i + 4 <= n) {
+      __m256i acc[8];
+      size_t end = n - i >= 4 * LANEFOLD ? i + 4 * LANEFOLD : n & ~(size_t)3;
+      int p;
+      for (p = 0; p < 8; p++)
+        acc[p] = _mm256_setzero_si256();
+      for (; i < end; i += 4) {
+        __m256i x = _mm256_cvtepu32_epi64(
+          _mm_loadu_si128((const __m128i *)(vals + i)));
+        __m256i e, m, sign, spec, pos;
+        x = _mm256_xor_si256(x, flip);
+        e = _mm256_and_si256(_mm256_srli_epi64(x, 23), expmask);
+        spec = _mm256_cmpeq_epi64(e, specexp);
+        special |= _mm256_movemask_epi8(spec);
+        m = _mm256_and_si256(x, mantmask);
+        // implicit bit for normal values, denormals have exponent 1
+        m = _mm256_or_si256(m, _mm256_andnot_si256(
+          _mm256_cmpeq_epi64(e, _mm256_setzero_si256()), implicit));
+        e = _mm256_or_si256(e, _mm256_and_si256(
+          _mm256_cmpeq_epi64(e, _mm256_setzero_si256()), one));
+        m = _mm256_sllv_epi64(m, _mm256_and_si256(e, _mm256_set1_epi64x(31)));
+        sign = _mm256_sub_epi64(_mm256_setzero_si256(),
+                                _mm256_srli_epi64(x, 31));
+        m = _mm256_sub_epi64(_mm256_xor_si256(m, sign), sign);
+        m = _mm256_andnot_si256(spec, m);
+        pos = _mm256_srli_epi64(e, 5);
+        for (p = 0; p < 8; p++)
+          acc[p] = _mm256_add_epi64(acc[p], _mm256_and_si256(m,
+                     _mm256_cmpeq_epi64(pos, _mm256_set1_epi64x(p))));
+      }
+      for (p = 0; p < 8; p++) {
+        int64_t lane[4];
+        _mm256_storeu_si256((__m256i *)lane, acc[p]);
+        add_wide(wide, lane[0] + lane[1] + lane[2] + lane[3], p);
+      }
+    }
+    special |= add_wide_tail(wide, vals + i, n - i, signflip);
+    if (special) // Inf/NaN
+      set_overflow(preg);
+    fold_wide(preg, wide);
+    vals += n;
+    cnt -= n;
+  }
+}
+
+__attribute__((target("avx512f")))
+static void add_array_avx512(efac_register_t *preg, const float *vals,
+                             size_t cnt, uint32_t signflip) {
+  const __m512i one = _mm512_set1_epi64(1);
+  const __m512i flip = _mm512_set1_epi64(signflip);
+  const __m512i expmask = _mm512_set1_epi64(0xff);
+  const __m512i mantmask = _mm512_set1_epi64(0x7fffff);
+  const __m512i implicit = _mm512_set1_epi64(0x800000);
+  while (cnt) {
+    int64_t wide[9] = {0};
+    size_t n = cnt < BINFOLD ? cnt : BINFOLD;
+    size_t i = 0;
+    __mmask8 special = 0;
+    while (i + 8 <= n) {
+      __m512i acc[8];
+      size_t end = n - i >= 8 * LANEFOLD ? i + 8 * LANEFOLD : n & ~(size_t)7;
+      int p;
+      for (p = 0; p < 8; p++)
+        acc[p] = _mm512_setzero_si512();
+      for (; i < end; i += 8) {
+        __m512i x = _mm512_cvtepu32_epi64(
+          _mm256_loadu_si256((const __m256i *)(vals + i)));
+        __m512i e, m, sign, pos;
+        __mmask8 spec;
+        x = _mm512_xor_si512(x, flip);
+        e = _mm512_and_si512(_mm512_srli_epi64(x, 23), expmask);
+        spec = _mm512_cmpeq_epi64_mask(e, expmask);
+        special |= spec;
+        m = _mm512_and_si512(x, mantmask);
+        // implicit bit for normal values, denormals have exponent 1
+        m = _mm512_mask_or_epi64(m, _mm512_test_epi64_mask(e, e), m, implicit);
+        e = _mm512_max_epu64(e, one);
+        m = _mm512_sllv_epi64(m, _mm512_and_si512(e, _mm512_set1_epi64(31)));
+        sign = _mm512_sub_epi64(_mm512_setzero_si512(),
+                                _mm512_srli_epi64(x, 31));
+        m = _mm512_maskz_sub_epi64(~spec, _mm512_xor_si512(m, sign), sign);
+        pos = _mm512_srli_epi64(e, 5);
+        for (p = 0; p < 8; p++)
+          acc[p] = _mm512_mask_add_epi64(acc[p],
+                     _mm512_cmpeq_epi64_mask(pos, _mm512_set1_epi64(p)),
+                     acc[p], m);
+      }
+      for (p = 0; p < 8; p++)
+        add_wide(wide, _mm512_reduce_add_epi64(acc[p]), p);
+    }
+    special |= add_wide_tail(wide, vals + i, n - i, signflip);
+    if (special) // Inf/NaN
+      set_overflow(preg);
+    fold_wide(preg, wide);
+    vals += n;
+    cnt -= n;
+  }
+}
+
+//! array add kernel for this CPU, chosen by efac_init
+static void (*add_array_kernel)(efac_register_t *preg, const float *vals,
+                                size_t cnt, uint32_t signflip) = add_array;
+
+static void add_half(efac_reg16_t *r, const uint16_t *vals, size_t cnt);
+static void add_half_f16c(efac_reg16_t *r, const uint16_t *vals, size_t cnt);
+static void (*add_half_kernel)(efac_reg16_t *r, const uint16_t *vals,
+                               size_t cnt) = add_half;
+
+static int block_sum(const float *vals, size_t cnt, double *sum,
+                     double *abssum);
+static int block_sum_avx2(const float *vals, size_t cnt, double *sum,
+                          double *abssum);
+//! block sum of efac_sum_adaptive for this CPU, chosen by efac_init
+static int (*block_sum_kernel)(const float *vals, size_t cnt, double *sum,
+                               double *abssum) = block_sum;
+
+static void add_squares(efac_register_t *preg, const float *vals, size_t cnt);
+static void add_squares_avx512(efac_register_t *preg, const float *vals,
+                               size_t cnt);
+//! squares kernel for this CPU, chosen by efac_init
+static void (*add_squares_kernel)(efac_register_t *preg, const float *vals,
+                                  size_t cnt) = add_squares;
+
+static void dot_scalar(efac_register_t *preg, const float *a, const float *b,
+                       const int *idx, size_t cnt, uint32_t signflip);
+static void dot_avx512(efac_register_t *preg, const float *a, const float *b,
+                       const int *idx, size_t cnt, uint32_t signflip);
+//! dot product kernel for this CPU, chosen by efac_init
+static void (*dot_kernel)(efac_register_t *preg, const float *a,
+                          const float *b, const int *idx, size_t cnt,
+                          uint32_t signflip) = dot_scalar;
+
+/**
+ * Choose the fastest array add kernel the CPU supports, the EFAC_SIMD
+ * environment variable (scalar, avx2, avx512) can select a slower one.
+ */
+static void select_kernel(void) {
+  const char *force = getenv("EFAC_SIMD");
+  __builtin_cpu_init();
+  add_array_kernel = add_array;
+  add_half_kernel = add_half;
+  block_sum_kernel = block_sum;
+  add_squares_kernel = add_squares;
+  dot_kernel = dot_scalar;
+  if (force && !strcmp(force, "scalar"))
+    return;
+  if (__builtin_cpu_supports("avx2")) {
+    add_array_kernel = add_array_avx2;
+    block_sum_kernel = block_sum_avx2;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c"))
+    add_half_kernel = add_half_f16c;
+  if (force && !strcmp(force, "avx2"))
+    return;
+  if (__builtin_cpu_supports("avx512f")) {
+    add_array_kernel = add_array_avx512;
+    add_squares_kernel = add_squares_avx512;
+    dot_kernel = dot_avx512;
+  }
+}
+
+void efac_reg_add_array(efac_register_t *preg, const float *vals, size_t cnt) {
+  preg->cached = 0;
+  STAT(preg, adds, cnt);
+  add_array_kernel(preg, vals, cnt, 0);
+}
+
+void efac_reg_add_values(efac_register_t *preg, const float *vals,
+                         size_t cnt, uint32_t signflip) {
+  size_t i;
+  STAT(preg, subs, signflip ? cnt : 0);
+  if (cnt >= BINMIN) {
+    preg->cached = 0;
+    STAT(preg, adds, cnt);
+    add_array_kernel(preg, vals, cnt, signflip);
+    return;
+  }
+  for (i = 0; i < cnt; i++)
+    efac_reg_add(preg, signflip ? -vals[i] : vals[i]);
+}
+
+void efac_add_array(int reg, const float *vals, size_t cnt) {
+  efac_reg_add_values(&regs[reg], vals, cnt, 0);
+}
+
+void efac_sub_array(int reg, const float *vals, size_t cnt) {
+  efac_reg_add_values(&regs[reg], vals, cnt, 0x80000000);
+}
+
+/**
+ * Add a double exactly, it must be a multiple of 2^-149 below 2^300.
+ */
+static void add_double(efac_register_t *preg, double val) {
+  int exp = 0;
+  int64_t mant = frexp(val, &exp) * (1LL << 53);
+  int bit = exp - 53 - REGEXP;
+  if (!mant)
+    return;
+  preg->cached = 0;
+  add_shifted(preg, bit >> 5, mant, bit & 31);
+}
+
+/**
+ * Check if the double sum of a block is exact: it is if all values are
+ * multiples of the ulp u of the smallest one (zeros aside) and the sum
+ * of magnitudes is below 2^53 u, then no partial sum in any order is
+ * rounded. A factor 2 covers the rounding of abssum.
+ * \param minexp smallest exponent field of the nonzero values, in place
+ */
+static int block_exact(double abssum, uint32_t minexp) {
+  minexp >>= 23;
+  // denormals have the ulp of exponent 1
+  return abssum < ldexp(1, (minexp | !minexp) - 150 + 52);
+}
+
+/**
+ * Sum a block of efac_sum_adaptive in double, in any order.
+ * \param sum [out] sum of the block
+ * \param abssum [out] sum of the magnitudes, for the error bound
+ * \return 1 if sum is exact
+ */
+static int block_sum(const float *vals, size_t cnt, double *sum,
+                     double *abssum) {
+  double s[8] = {0}, a[8] = {0};
+  uint32_t lo[8];
+  uint32_t minexp = 0x7f800000;
+  size_t i;
+  int j;
+  for (j = 0; j < 8; j++)
+    lo[j] = 0x7f800000;
+  for (i = 0; i + 8 <= cnt; i += 8) {
+    for (j = 0; j < 8; j++) {
+      union {
+        float f;
+        uint32_t i;
+      } v;
+      uint32_t exp;
+      v.f = vals[i + j];
+      exp = v.i << 1 ? v.i & 0x7f800000 : 0x7f800000;
+      s[j] += v.f;
+      a[j] += fabsf(v.f);
+      lo[j] = exp < lo[j] ? exp : lo[j];
+    }
+  }
+  for (; i < cnt; i++) {
+    union {
+      float f;
+      uint32_t i;
+    } v;
+    uint32_t exp;
+    v.f = vals[i];
+    exp = v.i << 1 ? v.i & 0x7f800000 : 0x7f800000;
+    s[0] += v.f;
+    a[0] += fabsf(v.f);
+    lo[0] = exp < lo[0] ? exp : lo[0];
+  }
+  *sum = *abssum = 0;
+  for (j = 0; j < 8; j++) {
+    *sum += s[j];
+    *abssum += a[j];
+    minexp = lo[j] < minexp ? lo[j] : minexp;
+  }
+  return block_exact(*abssum, minexp);
+}
+
+__attribute__((target("avx2")))
+static int block_sum_avx2(const float *vals, size_t cnt, double *sum,
+                          double *abssum) {
+  const __m256 absmask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  const __m256i expmask = _mm256_set1_epi32(0x7f800000);
+  __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+  __m256d a0 = _mm256_setzero_pd(), a1 = _mm256_setzero_pd();
+  __m256i lo = expmask;
+  double s[4], a[4];
+  uint32_t e[8];
+  uint32_t minexp = 0x7f800000;
+  size_t i;
+  int j;
+  for (i = 0; i + 8 <= cnt; i += 8) {
+    __m256 x = _mm256_loadu_ps(vals + i);
+    __m256 ax = _mm256_and_ps(x, absmask);
+    __m256i exp = _mm256_and_si256(_mm256_castps_si256(x), expmask);
+    // zeros do not limit the ulp
+    exp = _mm256_blendv_epi8(exp, expmask, _mm256_castps_si256(
+            _mm256_cmp_ps(ax, _mm256_setzero_ps(), _CMP_EQ_OQ)));
+    lo = _mm256_min_epu32(lo, exp);
+    s0 = _mm256_add_pd(s0, _mm256_cvtps_pd(_mm256_castps256_ps128(x)));
+    s1 = _mm256_add_pd(s1, _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)));
+    a0 = _mm256_add_pd(a0, _mm256_cvtps_pd(_mm256_castps256_ps128(ax)));
+    a1 = _mm256_add_pd(a1, _mm256_cvtps_pd(_mm256_extractf128_ps(ax, 1)));
+  }
+  _mm256_storeu_pd(s, _mm256_add_pd(s0, s1));
+  _mm256_storeu_pd(a, _mm256_add_pd(a0, a1));
+  _mm256_storeu_si256((__m256i *)e, lo);
+  *sum = *abssum = 0;
+  for (j = 0; j < 4; j++) {
+    *sum += s[j];
+    *abssum += a[j];
+  }
+  for (j = 0; j < 8; j++)
+    minexp = e[j] < minexp ? e[j] : minexp;
+  for (; i < cnt; i++) {
+    union {
+      float f;
+      uint32_t i;
+    } v;
+    uint32_t exp;
+    v.f = vals[i];
+    exp = v.i << 1 ? v.i & 0x7f800000 : 0x7f800000;
+    *sum += v.f;
+    *abssum += fabsf(v.f);
+    minexp = exp < minexp ? exp : minexp;
+  }
+  return block_exact(*abssum, minexp);
+}
+
+float efac_sum_adaptive(const float *vals, size_t cnt) {
+  efac_register_t reg;
+  double total = 0, err = 0;
+  double sum, abssum;
+  size_t i, n, run;
+  union {
+    float f;
+    uint32_t i;
+  } lo, hi;
+  // Rounding any sum of n values errs by less than (n - 1) u times the
+  // sum of their magnitudes, with u = DBL_EPSILON / 2. Every bound is
+  // doubled, which covers the rounding of err itself.
+  for (i = 0; i < cnt; i += n) {
+    n = cnt - i < ADAPTBLOCK ? cnt - i : ADAPTBLOCK;
+    if (!block_sum_kernel(vals + i, n, &sum, &abssum))
+      err += abssum * n * DBL_EPSILON;
+    total += sum;
+    err += fabs(total) * DBL_EPSILON;
+  }
+  // the subtraction and addition below round as well
+  err += fabs(total) * DBL_EPSILON;
+  lo.f = total - err;
+  hi.f = total + err;
+  // rounding to float is monotonic, so if both ends of the interval round
+  // to the same float (same zero sign too) so does the exact sum. Inf and
+  // NaN inputs make total non-finite and take the exact path.
+  if (isfinite(total) && lo.i == hi.i)
+    return lo.f;
+  // add the exact blocks as their double sums, the others value by value
+  efac_reg_clear(&reg);
+  for (i = run = 0; i < cnt; i += n) {
+    n = cnt - i < ADAPTBLOCK ? cnt - i : ADAPTBLOCK;
+    if (block_sum_kernel(vals + i, n, &sum, &abssum)) {
+      if (i > run)
+        efac_reg_add_values(&reg, vals + run, i - run, 0);
+      add_double(&reg, sum);
+      run = i + n;
+    }
+  }
+  if (cnt > run)
+    efac_reg_add_values(&reg, vals + run, cnt - run, 0);
+  return efac_reg_read(&reg, 4);
+}
+
+/**
+ * Add the exact product of two floats. It has at most 48 bits, so
+ * calculating it in double does not round.
+ */
+static void add_product(efac_register_t *preg, float a, float b) {
+  int exp = 0;
+  double prod = (double)a * b;
+  int64_t mant = frexp(prod, &exp) * (1LL << 53);
+  if (prod - prod) { // Inf/NaN
+    set_overflow(preg);
+    return;
+  }
+  if (!mant) return;
+  exp -= 53 + REGEXP;
+  add_shifted(preg, exp >> 5, mant, exp & 31);
+}
+
+/**
+ * Bin the products by the sum of the float exponents, so the bin value is
+ * the plain 48 bit integer product of the mantissas.
+ * Bins 2 to 508 are used, with denormals counting as exponent 1.
+ */
+static void dot_array(efac_register_t *preg, const float *a, ptrdiff_t inca,
+                      const float *b, ptrdiff_t incb, size_t cnt,
+                      uint32_t signflip) {
+  int64_t bins[BINSETS][512];
+  while (cnt) {
+    size_t i;
+    size_t n = cnt < DOTFOLD ? cnt : DOTFOLD;
+    int special = 0;
+    int exp;
+    memset(bins, 0, sizeof(bins));
+    for (i = 0; i < n; i++) {
+      union {
+        float f;
+        uint32_t i;
+      } va, vb;
+      int64_t sign;
+      int expa, expb;
+      int64_t mant;
+      va.f = *a;
+      vb.f = *b;
+      a += inca;
+      b += incb;
+      sign = (int32_t)(va.i ^ vb.i ^ signflip) >> 31;
+      expa = (va.i >> 23) & 0xff;
+      expb = (vb.i >> 23) & 0xff;
+      mant = (int64_t)((va.i & 0x7fffff) | (expa ? 0x800000 : 0)) *
+                      ((vb.i & 0x7fffff) | (expb ? 0x800000 : 0));
+      bins[i & (BINSETS - 1)][(expa | !expa) + (expb | !expb)] += (mant ^ sign) - sign;
+      special |= ((expa + 1) | (expb + 1)) >> 8;
+    }
+    if (special) // Inf/NaN
+      set_overflow(preg);
+    for (exp = 2; exp < 509; exp++) {
+      // the product of the mantissas has scale 2^(exp - 300)
+      int bit = exp - 300 - REGEXP;
+      int64_t mant = 0;
+      for (i = 0; i < BINSETS; i++)
+        mant += bins[i][exp];
+      if (mant)
+        add_shifted(preg, bit >> 5, mant, bit & 31);
+    }
+    cnt -= n;
+  }
+}
+
+/**
+ * Scalar dot product kernel, the b values picked by idx are gathered
+ * into a buffer for dot_array.
+ */
+static void dot_scalar(efac_register_t *preg, const float *a, const float *b,
+                       const int *idx, size_t cnt, uint32_t signflip) {
+  float buf[DOTGATHER];
+  size_t i, n;
+  if (cnt < BINMIN) {
+    for (i = 0; i < cnt; i++)
+      add_product(preg, signflip ? -a[i] : a[i], idx ? b[idx[i]] : b[i]);
+    return;
+  }
+  if (!idx) {
+    dot_array(preg, a, 1, b, 1, cnt, signflip);
+    return;
+  }
+  for (; cnt; cnt -= n) {
+    n = cnt < DOTGATHER ? cnt : DOTGATHER;
+    for (i = 0; i < n; i++)
+      buf[i] = b[idx[i]];
+    dot_array(preg, a, 1, buf, 1, n, signflip);
+    a += n;
+    idx += n;
+  }
+}
+
+/**
+ * Vector dot product kernel, also used for squares. With the exponent
+ * sum ea + eb = 32 g + r, the product of the mantissas is at bit r of
+ * register bit 32 g + 75. The 48 bit product is split into 24 bit halves
+ * so that shifted by r they still fit into the 64 bit lanes of the
+ * accumulators of group g. Mostly all lanes of a vector are in the same
+ * group, the others take another masked add. The last vector is loaded
+ * with a mask, so short rows of a sparse matrix need no scalar tail.
+ */
+__attribute__((target("avx512f")))
+static void dot_avx512(efac_register_t *preg, const float *a, const float *b,
+                       const int *idx, size_t cnt, uint32_t signflip) {
+  const __m512i one = _mm512_set1_epi64(1);
+  const __m512i expmask = _mm512_set1_epi64(0xff);
+  const __m512i mantmask = _mm512_set1_epi64(0x7fffff);
+  const __m512i implicit = _mm512_set1_epi64(0x800000);
+  const __m512i halfmask = _mm512_set1_epi64(0xffffff);
+  const __m512i flip = _mm512_set1_epi64(signflip);
+  __mmask8 special = 0;
+  while (cnt) {
+    // group sums, lo + (hi << 24) at bit 32 g + 75
+    __int128 lototal[16], hitotal[16];
+    uint32_t used = 0;
+    size_t n = cnt < BINFOLD ? cnt : BINFOLD;
+    size_t i = 0;
+    int g;
+    while (i < n) {
+      __m512i lo[16], hi[16];
+      size_t end = n - i >= 8 * DOTLANEFOLD ? i + 8 * DOTLANEFOLD : n;
+      uint32_t fold = 0;
+      for (; i < end; i += 8) {
+        __mmask16 load = end - i >= 8 ? 0xff : (1 << (end - i)) - 1;
+        __mmask8 todo = load;
+        __m512i va, vb, ea, eb, m, e, sh, grp, sign, vlo, vhi;
+        va = _mm512_maskz_loadu_epi32(load, a + i);
+        if (idx)
+          vb = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), load,
+                 _mm512_maskz_loadu_epi32(load, idx + i), b, 4);
+        else
+          vb = _mm512_maskz_loadu_epi32(load, b + i);
+        va = _mm512_cvtepu32_epi64(_mm512_castsi512_si256(va));
+        vb = _mm512_cvtepu32_epi64(_mm512_castsi512_si256(vb));
+        ea = _mm512_and_si512(_mm512_srli_epi64(va, 23), expmask);
+        eb = _mm512_and_si512(_mm512_srli_epi64(vb, 23), expmask);
+        special |= _mm512_cmpeq_epi64_mask(ea, expmask) |
+                   _mm512_cmpeq_epi64_mask(eb, expmask);
+        // implicit bit for normal values, denormals have exponent 1
+        m = _mm512_mul_epu32(
+          _mm512_mask_or_epi64(_mm512_and_si512(va, mantmask),
+                               _mm512_test_epi64_mask(ea, ea),
+                               _mm512_and_si512(va, mantmask), implicit),
+          _mm512_mask_or_epi64(_mm512_and_si512(vb, mantmask),
+                               _mm512_test_epi64_mask(eb, eb),
+                               _mm512_and_si512(vb, mantmask), implicit));
+        e = _mm512_add_epi64(_mm512_max_epu64(ea, one),
+                             _mm512_max_epu64(eb, one));
+        sh = _mm512_and_si512(e, _mm512_set1_epi64(31));
+        grp = _mm512_srli_epi64(e, 5);
+        sign = _mm512_sub_epi64(_mm512_setzero_si512(), _mm512_srli_epi64(
+                 _mm512_xor_si512(_mm512_xor_si512(va, vb), flip), 31));
+        vlo = _mm512_sllv_epi64(_mm512_and_si512(m, halfmask), sh);
+        vhi = _mm512_sllv_epi64(_mm512_srli_epi64(m, 24), sh);
+        vlo = _mm512_sub_epi64(_mm512_xor_si512(vlo, sign), sign);
+        vhi = _mm512_sub_epi64(_mm512_xor_si512(vhi, sign), sign);
+        while (todo) {
+          __mmask8 same;
+          g = _mm_cvtsi128_si64(_mm512_castsi512_si128(
+                _mm512_maskz_compress_epi64(todo, grp)));
+          same = _mm512_mask_cmpeq_epi64_mask(todo, grp, _mm512_set1_epi64(g));
+          if (!(fold & (1 << g))) {
+            lo[g] = _mm512_setzero_si512();
+            hi[g] = _mm512_setzero_si512();
+            fold |= 1 << g;
+          }
+          lo[g] = _mm512_mask_add_epi64(lo[g], same, lo[g], vlo);
+          hi[g] = _mm512_mask_add_epi64(hi[g], same, hi[g], vhi);
+          todo &= ~same;
+        }
+      }
+      for (; fold; fold &= fold - 1) {
+        int64_t lane[8];
+        int j;
+        g = __builtin_ctz(fold);
+        if (!(used & (1 << g)))
+          lototal[g] = hitotal[g] = 0;
+        used |= 1 << g;
+        _mm512_storeu_si512(lane, lo[g]);
+        for (j = 0; j < 8; j++)
+          lototal[g] += lane[j];
+        _mm512_storeu_si512(lane, hi[g]);
+        for (j = 0; j < 8; j++)
+          hitotal[g] += lane[j];
+      }
+    }
+    for (; used; used &= used - 1) {
+      unsigned __int128 total;
+      int k;
+      g = __builtin_ctz(used);
+      total = lototal[g] + hitotal[g] * (1 << 24);
+      // bit 32 g + 75 is bit 11 of block g + 2, the top part is signed
+      for (k = 0; k < 3; k++)
+        if ((uint32_t)(total >> 32 * k))
+          add_shifted(preg, g + 2 + k, (uint32_t)(total >> 32 * k), 11);
+      if ((int32_t)(total >> 96))
+        add_shifted(preg, g + 5, (int32_t)(total >> 96), 11);
+    }
+    a += n;
+    if (idx)
+      idx += n;
+    else
+      b += n;
+    cnt -= n;
+  }
+  if (special) // Inf/NaN
+    set_overflow(preg);
+}
+
+void efac_reg_dot(efac_register_t *preg, const float *a, const float *b,
+                  const int *idx, size_t cnt, uint32_t signflip) {
+  preg->cached = 0;
+  STAT(preg, adds, cnt);
+  STAT(preg, subs, signflip ? cnt : 0);
+  dot_kernel(preg, a, b, idx, cnt, signflip);
+}
+
+void efac_dot(int reg, const float *a, const float *b, size_t cnt) {
+  efac_reg_dot(&regs[reg], a, b, NULL, cnt, 0);
+}
+
+void efac_dot_strided(int reg, const float *a, ptrdiff_t inca,
+                      const float *b, ptrdiff_t incb, size_t cnt) {
+  ptrdiff_t i;
+  if (inca == 1 && incb == 1) {
+    efac_dot(reg, a, b, cnt);
+    return;
+  }
+  regs[reg].cached = 0;
+  STAT(&regs[reg], adds, cnt);
+  if (cnt >= BINMIN) {
+    dot_array(&regs[reg], a, inca, b, incb, cnt, 0);
+    return;
+  }
+  // negative strides, the index must not wrap around in size_t
+  for (i = 0; i < (ptrdiff_t)cnt; i++)
+    add_product(&regs[reg], a[i * inca], b[i * incb]);
+}
+
+/**
+ * Bin the squares by the float exponent, like dot_array but with a
+ * single load and no sign.
+ */
+static void add_squares(efac_register_t *preg, const float *vals, size_t cnt) {
+  int64_t bins[BINSETS][256];
+  while (cnt) {
+    size_t i;
+    size_t n = cnt < DOTFOLD ? cnt : DOTFOLD;
+    int special = 0;
+    int exp;
+    memset(bins, 0, sizeof(bins));
+    for (i = 0; i < n; i++) {
+      union {
+        float f;
+        uint32_t i;
+      } v;
+      int64_t mant;
+      v.f = vals[i];
+      exp = (v.i >> 23) & 0xff;
+      mant = (v.i & 0x7fffff) | (exp ? 0x800000 : 0);
+      bins[i & (BINSETS - 1)][exp] += mant * mant;
+      special |= (exp + 1) >> 8;
+    }
+    if (special) // Inf/NaN
+      set_overflow(preg);
+    for (exp = 0; exp < 255; exp++) {
+      // the square of the mantissa has scale 2^(2 * exp - 300)
+      int bit = 2 * (exp | !exp) - 300 - REGEXP;
+      int64_t mant = 0;
+      for (i = 0; i < BINSETS; i++)
+        mant += bins[i][exp];
+      if (mant)
+        add_shifted(preg, bit >> 5, mant, bit & 31);
+    }
+    vals += n;
+    cnt -= n;
+  }
+}
+
+__attribute__((target("avx512f")))
+static void add_squares_avx512(efac_register_t *preg, const float *vals,
+                               size_t cnt) {
+  dot_avx512(preg, vals, vals, NULL, cnt, 0);
+}
+
+void efac_reg_add_squares(efac_register_t *preg, const float *vals,
+                          size_t cnt) {
+  size_t i;
+  preg->cached = 0;
+  STAT(preg, adds, cnt);
+  if (cnt >= BINMIN) {
+    add_squares_kernel(preg, vals, cnt);
+    return;
+  }
+  for (i = 0; i < cnt; i++)
+    add_product(preg, vals[i], vals[i]);
+}
+
 void efac_sub(int reg, float val) {
+  STAT(&regs[reg], subs, 1);
   efac_add(reg, -val);
 }
 
@@ -140,40 +1091,447 @@ void efac_sub4(int reg, float val1, float val2, float val3, float val4) {
   efac_sub(reg, val4);
 }
 
-static float efac_read_mode(int reg, int mode) {
-  int pos;
-  int setbit;
-  float res;
-  uint64_t value;
-  uint32_t tmp = regs[reg].allvalue;
-  int sign = tmp & (1 << REGSIZE);
-  if (sign) tmp = ~tmp;
-  tmp |= ~regs[reg].allmask;
-  pos = efac_log2(tmp);
-  if (pos >= REGSIZE)
-    return 1.0/0.0;
-  value = read(&regs[reg], pos);
-  setbit = efac_log2(value);
-  value <<= 32;
-  pos--;
-  if (pos >= 0) value |= read(&regs[reg], pos);
-  pos -= REGSIZE/2 - 4;
-  if (sign) value = -value;
+void efac_reg_add_wide(efac_register_t *preg, int pos, int64_t v) {
+  preg->cached = 0;
+  add64(preg, pos, v);
+}
+
+/**
+ * Add v * 2^-scale_bits, scale_bits must be in the EFAC_FIXED range.
+ * v is at most 2^125, so even the top part fits add_shifted.
+ */
+static void add_fixed(efac_register_t *preg, __int128 v, int scale_bits) {
+  int bit = EFAC_FIXED_ONE - scale_bits;
+  int64_t low = v & ((1LL << 62) - 1);
+  int64_t high = v >> 62;
+  preg->cached = 0;
+  if (low)
+    add_shifted(preg, bit / 32, low, bit % 32);
+  bit += 62;
+  if (high)
+    add_shifted(preg, bit / 32, high, bit % 32);
+}
+
+void efac_add_fixed(int reg, int64_t val, int scale_bits) {
+  STAT(&regs[reg], adds, 1);
+  if (scale_bits < EFAC_FIXED_MIN || scale_bits > EFAC_FIXED_MAX) {
+    regs[reg].cached = 0;
+    set_overflow(&regs[reg]);
+    return;
+  }
+  add_fixed(&regs[reg], val, scale_bits);
+}
+
+void efac_add_int64(int reg, int64_t val) {
+  STAT(&regs[reg], adds, 1);
+  add_fixed(&regs[reg], val, 0);
+}
+
+void efac_add_fixed_array(int reg, const int64_t *vals, size_t cnt,
+                          int scale_bits) {
+  __int128 sum = 0;
+  size_t i;
+  STAT(&regs[reg], adds, cnt);
+  if (scale_bits < EFAC_FIXED_MIN || scale_bits > EFAC_FIXED_MAX) {
+    regs[reg].cached = 0;
+    set_overflow(&regs[reg]);
+    return;
+  }
+  // exact, the sum of 2^62 values still has room in 128 bits
+  for (i = 0; i < cnt; i++)
+    sum += vals[i];
+  add_fixed(&regs[reg], sum, scale_bits);
+}
+
+void efac_add_int64_array(int reg, const int64_t *vals, size_t cnt) {
+  efac_add_fixed_array(reg, vals, cnt, 0);
+}
+
+#ifdef EFAC_STATS
+static void add_stats(struct efac_stats *dst, const struct efac_stats *src) {
+  int i;
+  dst->adds += src->adds;
+  dst->subs += src->subs;
+  dst->carries += src->carries;
+  dst->carry_blocks += src->carry_blocks;
+  if (src->carry_max > dst->carry_max)
+    dst->carry_max = src->carry_max;
+  for (i = 0; i < EFAC_STATS_CARRY_BINS; i++)
+    dst->carry_len[i] += src->carry_len[i];
+  dst->transitions += src->transitions;
+  dst->overflows += src->overflows;
+  dst->folds += src->folds;
+  for (i = 0; i < 5; i++)
+    dst->reads[i] += src->reads[i];
+  dst->read_scans += src->read_scans;
+}
+#endif
+
+void efac_reg_merge(efac_register_t *dst, efac_register_t *src) {
+  int i;
+  int carry = 0;
+  int neg;
+  dst->cached = 0;
+  normalize(dst);
+  normalize(src);
+  neg = !!(src->allvalue & (1 << REGSIZE));
+  if (!(src->allmask & (1 << REGSIZE))) // overflow
+    dst->allmask &= ~(~0u << REGSIZE);
+#ifdef EFAC_STATS
+  add_stats(&dst->stats, &src->stats);
+#endif
+  for (i = 0; i < REGSIZE; i++)
+    carry = do_add(dst, i, read(src, i), carry);
+  // the sign extension of src still has to be added above the blocks
+  if (carry != neg)
+    do_carry(dst, REGSIZE, neg ? -1 : 1);
+}
+
+void efac_save(int reg, uint32_t buf[512]) {
+  int i;
+  efac_register_t *preg = &regs[reg];
+  uint32_t all = (1 << (REGSIZE + 1)) - 1;
+  normalize(preg);
+  memset(buf, 0, SAVEPOS * sizeof(*buf));
+  buf[0] = 0x00070000;
+  if (!((preg->allvalue | ~preg->allmask) & all)) buf[0] |= 4;
+  if (!(preg->allmask & (1 << REGSIZE))) buf[0] |= 2;
+  if (preg->allvalue & (1 << REGSIZE)) buf[0] |= 1;
+  for (i = 0; i < REGSIZE; i++)
+    buf[SAVEPOS + i] = read(preg, i);
+  for (i += SAVEPOS; i < 512; i++)
+    buf[i] = -(buf[0] & 1);
+}
+
+void efac_restore(int reg, const uint32_t buf[512]) {
+  int i;
+  efac_register_t *preg = &regs[reg];
+  efac_clear(reg);
+  for (i = 0; i < REGSIZE; i++)
+    write(preg, i, buf[SAVEPOS + i]);
+  if (buf[0] & 1)
+    preg->allvalue |= ~0u << REGSIZE;
+  if (buf[0] & 2)
+    preg->allmask &= ~(~0u << REGSIZE);
+}
+
+uint32_t efac_reg_blocks(efac_register_t *preg, uint32_t blocks[REGSIZE]) {
+  uint32_t flags = 0;
+  int i;
+  normalize(preg);
+  if (preg->allvalue & (1 << REGSIZE)) flags |= 1;
+  if (!(preg->allmask & (1 << REGSIZE))) flags |= 2;
+  for (i = 0; i < REGSIZE; i++)
+    blocks[i] = read(preg, i);
+  return flags;
+}
+
+int efac_reg_magnitude(efac_register_t *preg, uint32_t mag[REGSIZE]) {
+  uint32_t flags = efac_reg_blocks(preg, mag);
+  int carry = 1;
+  int i;
+  if (flags & 2)
+    return -1;
+  if (!(flags & 1))
+    return 0;
+  for (i = 0; i < REGSIZE; i++) {
+    mag[i] = ~mag[i] + carry;
+    carry = carry && !mag[i];
+  }
+  return 1;
+}
+
+size_t efac_serialize(int reg, uint8_t *buf) {
+  uint32_t blocks[REGSIZE];
+  uint32_t flags = efac_reg_blocks(&regs[reg], blocks);
+  return efac_encode(buf, flags, 0, 0, blocks);
+}
+
+size_t efac_deserialize(int reg, const uint8_t *buf, size_t len) {
+  uint32_t blocks[REGSIZE];
+  efac_register_t *preg = &regs[reg];
+  uint32_t flags;
+  int16_t rofs, wofs;
+  int i;
+  size_t used = efac_decode(buf, len, &flags, &rofs, &wofs, blocks);
+  if (!used)
+    return 0;
+  efac_clear(reg);
+  for (i = 0; i < REGSIZE; i++)
+    write(preg, i, blocks[i]);
+  if (flags & 1)
+    preg->allvalue |= ~0u << REGSIZE;
+  if (flags & 2)
+    preg->allmask &= ~(~0u << REGSIZE);
+  return used;
+}
+
+size_t efac_serialize_array(int reg, int cnt, uint8_t *buf) {
+  size_t len = 0;
+  int i;
+  for (i = 0; i < cnt; i++)
+    len += efac_serialize(reg + i, buf + len);
+  return len;
+}
+
+size_t efac_deserialize_array(int reg, int cnt, const uint8_t *buf,
+                              size_t len) {
+  size_t used = 0;
+  int i;
+  for (i = 0; i < cnt; i++) {
+    size_t n = efac_deserialize(reg + i, buf + used, len - used);
+    if (!n)
+      return 0;
+    used += n;
+  }
+  return used;
+}
+
+/**
+ * Round a magnitude to a floating-point value with prec mantissa bits.
+ * \param sign 1 if the value is negative
+ * \param m top 64 bits of the magnitude, highest bit set
+ * \param e exponent of the lowest bit of m
+ * \param sticky 1 if there are set bits below m
+ * \param mode 0: towards zero, 1: away from zero, 2: towards -infinity,
+ *             3: towards +infinity, 4: nearest (ties to even)
+ * \param prec mantissa bits including the implicit one
+ * \param emin exponent of the lowest bit of the smallest denormal
+ * \param emax exponent of the highest bit of the largest finite value
+ */
+static double round_value(int sign, uint64_t m, int e, int sticky, int mode,
+                          int prec, int emin, int emax) {
+  int lsb = e + 64 - prec;
+  int shift;
+  uint64_t q, rem, half;
+  double res;
+  if (lsb < emin) lsb = emin;
+  shift = lsb - e;
+  if (shift > 64) {
+    sticky |= !!m;
+    q = rem = 0;
+    half = 1;
+  } else if (shift == 64) {
+    q = 0;
+    rem = m;
+    half = 1ULL << 63;
+  } else {
+    q = m >> shift;
+    rem = m & ((1ULL << shift) - 1);
+    half = 1ULL << (shift - 1);
+  }
   if (mode == 2) mode = !!sign;
   if (mode == 3) mode = !sign;
-  if (mode == 0) {
-    value &= ~((1ULL << (setbit + 8)) - 1);
-  } else if (mode == 1) {
-    value += (1ULL << (setbit + 8));
-    value &= ~((1ULL << (setbit + 8)) - 1);
-  } else {
-    value += (1ULL << (setbit + 7));
-    value &= ~((1ULL << (setbit + 8)) - 1);
+  if (mode == 1) {
+    q += rem || sticky;
+  } else if (mode == 4) {
+    q += rem > half || (rem == half && (sticky || (q & 1)));
   }
-  res = ldexpf(value, (pos << 5) - 126 - 25);
+  if (q && lsb + efac_log2_64(q) > emax) {
+    // overflow, only rounding towards zero stays finite
+    res = mode ? 1.0/0.0 : ldexp((1ULL << prec) - 1, emax - prec + 1);
+  } else
+    res = ldexp(q, lsb);
   return sign ? -res : res;
 }
 
+/**
+ * Round the magnitude w * 2^e, with low set if it is a bit more.
+ */
+static double round_bits(int sign, unsigned __int128 w, int e, int low,
+                         int mode, int prec, int emin, int emax) {
+  uint64_t m;
+  int bits;
+  if (!w)
+    return 0;
+  bits = w >> 64 ? 65 + efac_log2_64(w >> 64) : 1 + efac_log2_64(w);
+  if (bits > 64) {
+    low |= !!(w & ((((unsigned __int128)1) << (bits - 64)) - 1));
+    m = w >> (bits - 64);
+    e += bits - 64;
+  } else {
+    m = (uint64_t)w << (64 - bits);
+    e -= 64 - bits;
+  }
+  return round_value(sign, m, e, low, mode, prec, emin, emax);
+}
+
+/**
+ * Round a two's complement window of the register, shared by the
+ * float and double reads.
+ * \param sign 1 if the register value is negative
+ * \param w highest bits of the register value, width bits wide
+ * \param width width of w, at most 128
+ * \param e exponent of the lowest bit of w
+ * \param low 1 if there are set bits below w
+ */
+static double round_window(int sign, unsigned __int128 w, int width, int e,
+                           int low, int mode, int prec, int emin, int emax) {
+  if (sign) {
+    // magnitude is 2^width - w - low, w == 0 here means exactly 2^width
+    if (!w && !low) {
+      w = 1;
+      e += width;
+    } else {
+      w = -w - low;
+      if (width < 128)
+        w &= ((unsigned __int128)1 << width) - 1;
+    }
+  }
+  return round_bits(sign, w, e, low, mode, prec, emin, emax);
+}
+
+/**
+ * Fill the read cache of a register for some rounding modes, all from a
+ * single scan of the blocks.
+ * \param modes bit i set to read with rounding mode i
+ */
+static void read_modes(efac_register_t *preg, unsigned modes) {
+  int pos;
+  int i;
+  int low = 0;
+  unsigned __int128 w = 0;
+  uint32_t tmp;
+  int sign;
+  int mode;
+  STAT(preg, read_scans, 1);
+  normalize(preg);
+  tmp = preg->allvalue;
+  sign = !!(tmp & (1 << REGSIZE));
+  if (sign) tmp = ~tmp;
+  tmp |= ~preg->allmask;
+  pos = efac_log2(tmp);
+  if (pos >= REGSIZE) {
+    for (mode = 0; mode < 5; mode++)
+      preg->cache[mode] = 1.0/0.0;
+    preg->cached = 0x1f;
+    return;
+  }
+  for (i = pos; i > pos - 3; i--) {
+    w <<= 32;
+    if (i >= 0) w |= read(preg, i);
+  }
+  // blocks flagged all zeros in allmask/allvalue are the only zero ones
+  if (i >= 0)
+    low = !!((~preg->allmask | preg->allvalue) & ((2u << i) - 1));
+  for (mode = 0; mode < 5; mode++)
+    if (modes & (1 << mode))
+      preg->cache[mode] = round_window(sign, w, 96, 32 * (pos - 2) + REGEXP,
+                                       low, mode, 24, -149, 127);
+  preg->cached |= modes;
+}
+
+/**
+ * Count reads in the rounding modes set in modes.
+ */
+static void count_reads(efac_register_t *preg, unsigned modes) {
+#ifdef EFAC_STATS
+  int mode;
+  for (mode = 0; mode < 5; mode++)
+    preg->stats.reads[mode] += (modes >> mode) & 1;
+#else
+  (void)preg;
+  (void)modes;
+#endif
+}
+
+float efac_reg_read(efac_register_t *preg, int mode) {
+  count_reads(preg, 1 << mode);
+  if (!(preg->cached & (1 << mode)))
+    read_modes(preg, 1 << mode);
+  return preg->cache[mode];
+}
+
+static float efac_read_mode(int reg, int mode) {
+  return efac_reg_read(&regs[reg], mode);
+}
+
+void efac_read_all(int reg, float out[5]) {
+  efac_register_t *preg = &regs[reg];
+  count_reads(preg, 0x1f);
+  if (preg->cached != 0x1f)
+    read_modes(preg, 0x1f & ~preg->cached);
+  memcpy(out, preg->cache, sizeof(preg->cache));
+}
+
+double efac_round_magnitude(const uint32_t *mag, int len, int exp, int neg,
+                            int sticky, int mode) {
+  unsigned __int128 w = 0;
+  int pos = len - 1;
+  int i;
+  while (pos >= 0 && !mag[pos])
+    pos--;
+  if (pos < 0)
+    return 0;
+  for (i = pos; i > pos - 3; i--) {
+    w <<= 32;
+    if (i >= 0) w |= mag[i];
+  }
+  for (; i >= 0; i--)
+    sticky |= !!mag[i];
+  return round_bits(neg, w, 32 * (pos - 2) + exp, sticky, mode, 53, -1074,
+                    1023);
+}
+
+void efac_read_interval(int reg, float *lo, float *hi) {
+  efac_register_t *preg = &regs[reg];
+  count_reads(preg, 0xc);
+  if ((preg->cached & 0xc) != 0xc)
+    read_modes(preg, 0xc & ~preg->cached);
+  *lo = preg->cache[2];
+  *hi = preg->cache[3];
+}
+
+int efac_read_fixed(int reg, int scale_bits, int64_t *val) {
+  uint32_t blocks[REGSIZE];
+  uint32_t flags;
+  if (scale_bits < EFAC_FIXED_MIN || scale_bits > EFAC_FIXED_MAX) {
+    *val = 0;
+    return 1;
+  }
+  flags = efac_reg_blocks(&regs[reg], blocks);
+  return efac_fixed_from_blocks(blocks, flags, scale_bits, val);
+}
+
+int efac_read_int64(int reg, int64_t *val) {
+  return efac_read_fixed(reg, 0, val);
+}
+
+int efac_get_stats(int reg, struct efac_stats *stats) {
+#ifdef EFAC_STATS
+  *stats = regs[reg].stats;
+  return 1;
+#else
+  (void)reg;
+  memset(stats, 0, sizeof(*stats));
+  return 0;
+#endif
+}
+
+void efac_print_stats(FILE *f, int reg) {
+  static const char *mode_names[5] = {"zero", "inf", "ninf", "pinf", "nearest"};
+  static const char *len_names[EFAC_STATS_CARRY_BINS] = {
+    "1", "2", "3-4", "5-8", "9-16", "17+"
+  };
+  struct efac_stats st;
+  int i;
+  if (!efac_get_stats(reg, &st)) {
+    fprintf(f, "register %d: no statistics, build with -DEFAC_STATS\n", reg);
+    return;
+  }
+  fprintf(f, "register %d: %"PRIu64" adds, %"PRIu64" subs, %"PRIu64
+          " transitions, %"PRIu64" overflows, %"PRIu64" folds\n", reg,
+          st.adds, st.subs, st.transitions, st.overflows, st.folds);
+  fprintf(f, "  %"PRIu64" carries through %"PRIu64" blocks, at most %"PRIu64
+          "\n  carry length:", st.carries, st.carry_blocks, st.carry_max);
+  for (i = 0; i < EFAC_STATS_CARRY_BINS; i++)
+    fprintf(f, " %s %"PRIu64, len_names[i], st.carry_len[i]);
+  fprintf(f, "\n  reads:");
+  for (i = 0; i < 5; i++)
+    fprintf(f, " %s %"PRIu64, mode_names[i], st.reads[i]);
+  fprintf(f, ", %"PRIu64" scans\n", st.read_scans);
+}
+
 float efac_read(int reg) {
   return efac_read_mode(reg, 0);
 }
@@ -197,3 +1555,456 @@ float efac_read_round_pinf(int reg) {
 float efac_read_round_nearest(int reg) {
   return efac_read_mode(reg, 4);
 }
+
+/*
+ * Double registers, same scheme as above but with 64 bit blocks so that
+ * the allmask/allvalue bitmaps still fit into one word.
+ */
+
+efac_dregister_t *efac_get_double_register(int reg) {
+  return &dregs[reg];
+}
+
+void efac_dreg_clear(efac_dregister_t *preg) {
+  preg->allmask = -1;
+  preg->allvalue = 0;
+}
+
+void efac_clear_double(int reg) {
+  efac_dreg_clear(&dregs[reg]);
+}
+
+static uint64_t dread(efac_dregister_t *preg, int pos) {
+  uint64_t mask = 1ULL << pos;
+  int64_t val = preg->allvalue << (63 - pos);
+  return preg->allmask & mask ? (uint64_t)(val >> 63) : preg->buffer[pos];
+}
+
+static int do_dadd(efac_dregister_t *preg, int pos, uint64_t v, int carry) {
+  uint64_t oldval = dread(preg, pos);
+  uint64_t newval = oldval + v + carry;
+  uint64_t mask = 1ULL << pos;
+  preg->buffer[pos] = newval;
+  if (newval && newval != ~0ull) preg->allmask &= ~mask;
+  else {
+    preg->allmask |= mask;
+    if (newval) preg->allvalue |= mask;
+    else preg->allvalue &= ~mask;
+  }
+  return carry ? newval <= oldval : newval < oldval;
+}
+
+static void do_dcarry(efac_dregister_t *preg, int pos, int carry) {
+  uint64_t tmp = carry < 0 ? preg->allvalue | ~preg->allmask :
+                             preg->allvalue &  preg->allmask;
+  preg->allvalue = tmp + ((uint64_t)(int64_t)carry << pos);
+  tmp ^= preg->allvalue;
+  pos = efac_log2_64(tmp);
+  if (pos >= DREGSIZE) {
+    if (pos == DREGSIZE)
+      preg->allmask &= ~(-1ULL << DREGSIZE);
+    return;
+  } else if (!pos)
+    return;
+  preg->allvalue ^= 1ULL << pos;
+  do_dadd(preg, pos, carry, 0);
+}
+
+/**
+ * Add the signed v with its lowest bit at register bit bit.
+ */
+static void dadd_bit(efac_dregister_t *preg, int bit, int64_t v) {
+  int pos = bit >> 6;
+  int shift = bit & 63;
+  uint64_t lo = (uint64_t)v << shift;
+  int64_t hi = v >> (shift ? 64 - shift : 63);
+  int carry = do_dadd(preg, pos, lo, 0);
+  carry = do_dadd(preg, pos + 1, hi, carry);
+  if (carry == (hi < 0))
+    return;
+  do_dcarry(preg, pos + 2, hi < 0 ? -1 : 1);
+}
+
+void efac_dreg_add(efac_dregister_t *preg, double val) {
+  int exp = 0;
+  int64_t mant = frexp(val, &exp) * (1LL << 53);
+  if (val - val) { // Inf/NaN
+    preg->allmask &= ~(-1ULL << DREGSIZE);
+    return;
+  }
+  if (!mant) return;
+  exp -= 53 + DREGEXP;
+  if (exp < 0) {
+    mant >>= -exp;
+    exp = 0;
+  }
+  dadd_bit(preg, exp, mant);
+}
+
+void efac_add_double(int reg, double val) {
+  efac_dreg_add(&dregs[reg], val);
+}
+
+void efac_sub_double(int reg, double val) {
+  efac_add_double(reg, -val);
+}
+
+/**
+ * Array add for doubles. A 53 bit mantissa can only be added to an
+ * int64 bin 2^10 times, so instead of binning by exponent each value
+ * is split like in the vector kernels: mant << (bit & 31) is added in
+ * 32 bit parts to the sums of 32 bit blocks bit >> 5 and up, bit being
+ * the register bit of the lowest mantissa bit. The parts go to separate
+ * arrays, neighbouring entries would be combined into overlapping
+ * vector loads and stores that cannot be forwarded.
+ */
+static void add_double_array(efac_dregister_t *preg, const double *vals,
+                             size_t cnt, uint64_t signflip) {
+  int64_t sums[BINSETS][3][2048 / 32 + 2];
+  int i, k, p;
+  memset(sums, 0, sizeof(sums));
+  while (cnt) {
+    size_t j;
+    size_t n = cnt < DBLOCKFOLD ? cnt : DBLOCKFOLD;
+    int special = 0;
+    for (j = 0; j < n; j++) {
+      union {
+        double d;
+        uint64_t i;
+      } v;
+      int64_t sign;
+      int exp;
+      int bit;
+      int pos;
+      int64_t mant;
+      int64_t (*s)[2048 / 32 + 2] = sums[j & (BINSETS - 1)];
+      v.d = vals[j];
+      v.i ^= signflip;
+      sign = (int64_t)v.i >> 63;
+      exp = (v.i >> 52) & 0x7ff;
+      mant = (v.i & ((1ULL << 52) - 1)) | (exp ? 1ULL << 52 : 0);
+      mant = (mant ^ sign) - sign;
+      // Inf/NaN set the overflow flag, reads ignore what they add
+      special |= (exp + 1) >> 11;
+      bit = (exp | !exp) - 1;
+      pos = bit >> 5;
+      bit &= 31;
+      s[0][pos] += (uint32_t)((uint64_t)mant << bit);
+      // the bits above the lowest block, mant << bit >> 32
+      mant >>= 32 - bit;
+      s[1][pos + 1] += (uint32_t)mant;
+      s[2][pos + 2] += mant >> 32;
+    }
+    if (special) // Inf/NaN
+      preg->allmask &= ~(-1ULL << DREGSIZE);
+    for (i = 0; i < 3; i++) {
+      for (p = 0; p < 2048 / 32 + 2; p++) {
+        int64_t sum = 0;
+        for (k = 0; k < BINSETS; k++) {
+          sum += sums[k][i][p];
+          sums[k][i][p] = 0;
+        }
+        if (sum)
+          dadd_bit(preg, 32 * p, sum);
+      }
+    }
+    vals += n;
+    cnt -= n;
+  }
+}
+
+void efac_dreg_add_values(efac_dregister_t *preg, const double *vals,
+                          size_t cnt, uint64_t signflip) {
+  size_t i;
+  if (cnt >= BINMIN) {
+    add_double_array(preg, vals, cnt, signflip);
+    return;
+  }
+  for (i = 0; i < cnt; i++)
+    efac_dreg_add(preg, signflip ? -vals[i] : vals[i]);
+}
+
+void efac_add_double_array(int reg, const double *vals, size_t cnt) {
+  efac_dreg_add_values(&dregs[reg], vals, cnt, 0);
+}
+
+void efac_sub_double_array(int reg, const double *vals, size_t cnt) {
+  efac_dreg_add_values(&dregs[reg], vals, cnt, 1ULL << 63);
+}
+
+void efac_dreg_merge(efac_dregister_t *dst, efac_dregister_t *src) {
+  int i;
+  int carry = 0;
+  int neg = !!(src->allvalue & (1ULL << DREGSIZE));
+  if (!(src->allmask & (1ULL << DREGSIZE))) // overflow
+    dst->allmask &= ~(-1ULL << DREGSIZE);
+  for (i = 0; i < DREGSIZE; i++)
+    carry = do_dadd(dst, i, dread(src, i), carry);
+  if (carry != neg)
+    do_dcarry(dst, DREGSIZE, neg ? -1 : 1);
+}
+
+double efac_dreg_read(efac_dregister_t *preg, int mode) {
+  int pos;
+  int i;
+  int low = 0;
+  unsigned __int128 w = 0;
+  uint64_t tmp = preg->allvalue;
+  int sign = !!(tmp & (1ULL << DREGSIZE));
+  if (sign) tmp = ~tmp;
+  tmp |= ~preg->allmask;
+  pos = efac_log2_64(tmp);
+  if (pos >= DREGSIZE)
+    return 1.0/0.0;
+  for (i = pos; i > pos - 2; i--) {
+    w <<= 64;
+    if (i >= 0) w |= dread(preg, i);
+  }
+  for (; i >= 0; i--)
+    low |= !!dread(preg, i);
+  return round_window(sign, w, 128, 64 * (pos - 1) + DREGEXP,
+                      low, mode, 53, -1074, 1023);
+}
+
+static double efac_read_double_mode(int reg, int mode) {
+  return efac_dreg_read(&dregs[reg], mode);
+}
+
+double efac_read_double(int reg) {
+  return efac_read_double_mode(reg, 0);
+}
+
+double efac_read_double_round_zero(int reg) {
+  return efac_read_double_mode(reg, 0);
+}
+
+double efac_read_double_round_inf(int reg) {
+  return efac_read_double_mode(reg, 1);
+}
+
+double efac_read_double_round_ninf(int reg) {
+  return efac_read_double_mode(reg, 2);
+}
+
+double efac_read_double_round_pinf(int reg) {
+  return efac_read_double_mode(reg, 3);
+}
+
+double efac_read_double_round_nearest(int reg) {
+  return efac_read_double_mode(reg, 4);
+}
+
+/*
+ * Compact registers for half and bfloat16 values. Both formats are
+ * within 2^-133 .. 2^128, five 64 bit limbs leave 2^59 of headroom.
+ */
+
+//! exponent of bit 0 of an efac_reg16_t
+#define R16EXP (-133)
+//! efac_reg16_t bit of 2^-24, the unit of half values
+#define HALFBIT (-24 - R16EXP)
+//! half values per double lane between conversions, the sums stay
+//! below 2^29 and thus exact
+#define HALFFOLD 4096
+//! bfloat16 values converted to float per call of the float kernel
+#define BF16CHUNK 1024
+
+/**
+ * Add v * 2^(bit + R16EXP), bits of v below bit 0 must be zero.
+ */
+static void add_bits16(efac_reg16_t *r, int bit, int64_t v) {
+  unsigned __int128 t;
+  uint64_t ext = -(uint64_t)(v < 0);
+  int carry = 0;
+  int i;
+  if (bit < 0) {
+    v >>= -bit;
+    bit = 0;
+  }
+  t = (unsigned __int128)(__int128)v << (bit % 64);
+  for (i = bit / 64; i < EFAC_REG16_LIMBS; i++) {
+    uint64_t add = i == bit / 64 ? (uint64_t)t :
+                   i == bit / 64 + 1 ? (uint64_t)(t >> 64) : ext;
+    uint64_t x;
+    int c = __builtin_add_overflow(r->limb[i], add, &x);
+    c |= __builtin_add_overflow(x, (uint64_t)carry, &x);
+    r->limb[i] = x;
+    carry = c;
+    if (i > bit / 64 && !ext && !carry)
+      break;
+  }
+}
+
+/**
+ * Half value in units of 2^-24, at most 2^41
+ * \param special set to 1 for Inf and NaN
+ */
+static int64_t half_units(uint16_t h, int *special) {
+  int exp = (h >> 10) & 0x1f;
+  int64_t mant = (h & 0x3ff) | (exp ? 0x400 : 0);
+  if (exp == 0x1f) {
+    *special = 1;
+    return 0;
+  }
+  exp |= !exp;
+  mant <<= exp - 1;
+  return h & 0x8000 ? -mant : mant;
+}
+
+static void add_half(efac_reg16_t *r, const uint16_t *vals, size_t cnt) {
+  while (cnt) {
+    // 2^20 values of at most 2^41 each
+    size_t n = cnt < (1 << 20) ? cnt : 1 << 20;
+    int64_t sum = 0;
+    int special = 0;
+    size_t i;
+    for (i = 0; i < n; i++)
+      sum += half_units(vals[i], &special);
+    add_bits16(r, HALFBIT, sum);
+    r->overflow |= special;
+    vals += n;
+    cnt -= n;
+  }
+}
+
+/**
+ * Convert with F16C and add in double, which is exact for HALFFOLD
+ * values per lane. Inf and NaN make the lane non-finite.
+ */
+__attribute__((target("avx2,f16c")))
+static void add_half_f16c(efac_reg16_t *r, const uint16_t *vals, size_t cnt) {
+  while (cnt) {
+    size_t n = cnt < 16 * HALFFOLD ? cnt : 16 * HALFFOLD;
+    __m256d acc[4];
+    double lanes[16];
+    int64_t sum = 0;
+    int special = 0;
+    size_t i;
+    int p;
+    for (p = 0; p < 4; p++)
+      acc[p] = _mm256_setzero_pd();
+    for (i = 0; i + 16 <= n; i += 16) {
+      __m256 a = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(vals + i)));
+      __m256 b = _mm256_cvtph_ps(
+        _mm_loadu_si128((const __m128i *)(vals + i + 8)));
+      acc[0] = _mm256_add_pd(acc[0], _mm256_cvtps_pd(_mm256_castps256_ps128(a)));
+      acc[1] = _mm256_add_pd(acc[1], _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1)));
+      acc[2] = _mm256_add_pd(acc[2], _mm256_cvtps_pd(_mm256_castps256_ps128(b)));
+      acc[3] = _mm256_add_pd(acc[3], _mm256_cvtps_pd(_mm256_extractf128_ps(b, 1)));
+    }
+    for (p = 0; p < 4; p++)
+      _mm256_storeu_pd(lanes + 4 * p, acc[p]);
+    for (p = 0; p < 16; p++) {
+      if (isfinite(lanes[p]))
+        sum += (int64_t)(lanes[p] * (1 << 24));
+      else
+        special = 1;
+    }
+    for (; i < n; i++)
+      sum += half_units(vals[i], &special);
+    add_bits16(r, HALFBIT, sum);
+    r->overflow |= special;
+    vals += n;
+    cnt -= n;
+  }
+}
+
+void efac_reg16_clear(efac_reg16_t *r) {
+  memset(r, 0, sizeof(*r));
+}
+
+void efac_reg16_add_half(efac_reg16_t *r, uint16_t val) {
+  int special = 0;
+  int64_t v = half_units(val, &special);
+  r->overflow |= special;
+  if (v)
+    add_bits16(r, HALFBIT, v);
+}
+
+void efac_reg16_add_bf16(efac_reg16_t *r, uint16_t val) {
+  int exp = (val >> 7) & 0xff;
+  int64_t mant = (val & 0x7f) | (exp ? 0x80 : 0);
+  if (exp == 0xff) {
+    r->overflow = 1;
+    return;
+  }
+  if (!mant)
+    return;
+  exp |= !exp;
+  add_bits16(r, exp - 1, val & 0x8000 ? -mant : mant);
+}
+
+void efac_reg16_add_half_array(efac_reg16_t *r, const uint16_t *vals,
+                               size_t cnt) {
+  add_half_kernel(r, vals, cnt);
+}
+
+/**
+ * Goes through the float kernels with a temporary register that stays
+ * in L1 like the compact one, a bfloat16 is the upper half of a float.
+ */
+void efac_reg16_add_bf16_array(efac_reg16_t *r, const uint16_t *vals,
+                               size_t cnt) {
+  union {
+    float f[BF16CHUNK];
+    uint32_t i[BF16CHUNK];
+  } buf;
+  efac_register_t tmp;
+  size_t i, n;
+  int pos;
+  for (; cnt; cnt -= n, vals += n) {
+    n = cnt < BF16CHUNK ? cnt : BF16CHUNK;
+    for (i = 0; i < n; i++)
+      buf.i[i] = (uint32_t)vals[i] << 16;
+    efac_reg_clear(&tmp);
+    efac_reg_add_values(&tmp, buf.f, n, 0);
+    normalize(&tmp);
+    if (!(tmp.allmask & (1 << REGSIZE)))
+      r->overflow = 1;
+    // the chunk sum is below 2^138, the blocks above are sign extension
+    for (pos = 0; pos < REGSIZE; pos++) {
+      int bit = 32 * pos + REGEXP - R16EXP;
+      if (bit > 138 - R16EXP)
+        break;
+      if (bit > -32 && read(&tmp, pos))
+        add_bits16(r, bit, read(&tmp, pos));
+    }
+    if (tmp.allvalue & (1 << REGSIZE))
+      add_bits16(r, 32 * pos + REGEXP - R16EXP, -1);
+  }
+}
+
+void efac_reg16_merge(efac_reg16_t *dst, const efac_reg16_t *src) {
+  int carry = 0;
+  int i;
+  for (i = 0; i < EFAC_REG16_LIMBS; i++) {
+    uint64_t x;
+    int c = __builtin_add_overflow(dst->limb[i], src->limb[i], &x);
+    c |= __builtin_add_overflow(x, (uint64_t)carry, &x);
+    dst->limb[i] = x;
+    carry = c;
+  }
+  dst->overflow |= src->overflow;
+}
+
+void efac_reg16_read_all(const efac_reg16_t *r, float out[5]) {
+  uint64_t ext = -(r->limb[EFAC_REG16_LIMBS - 1] >> 63);
+  unsigned __int128 w;
+  int pos, i, mode;
+  int low = 0;
+  for (pos = EFAC_REG16_LIMBS - 1; pos > 1 && r->limb[pos] == ext; pos--)
+    ;
+  w = (unsigned __int128)r->limb[pos] << 64 | r->limb[pos - 1];
+  for (i = 0; i < pos - 1; i++)
+    low |= !!r->limb[i];
+  for (mode = 0; mode < 5; mode++)
+    out[mode] = r->overflow ? 1.0/0.0 :
+                round_window(!!ext, w, 128, 64 * (pos - 1) + R16EXP, low,
+                             mode, 24, -149, 127);
+}
+
+float efac_reg16_read_nearest(const efac_reg16_t *r) {
+  float out[5];
+  efac_reg16_read_all(r, out);
+  return out[4];
+}
@@ -2,22 +2,277 @@
 #define LIBSOFTEFAC_H
 
 #include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "efac_serial.h"
+#include "efac_fixed.h"
 
 int efac_init(void);
 void efac_save(int reg, uint32_t buf[512]);
 void efac_restore(int reg, const uint32_t buf[512]);
+// compact form of efac_save, see efac_serial.h; buf needs EFAC_SERIAL_MAX
+// bytes per register, the return value is the number of bytes used (0 on
+// invalid input). Exponent offsets are not supported and read back as 0.
+size_t efac_serialize(int reg, uint8_t *buf);
+size_t efac_deserialize(int reg, const uint8_t *buf, size_t len);
+// the same for registers reg to reg + cnt - 1, stored back to back
+size_t efac_serialize_array(int reg, int cnt, uint8_t *buf);
+size_t efac_deserialize_array(int reg, int cnt, const uint8_t *buf,
+                              size_t len);
 void efac_clear(int reg);
 void efac_add(int reg, float val);
 void efac_sub(int reg, float val);
 void efac_add4(int reg, float val1, float val2, float val3, float val4);
 void efac_sub4(int reg, float val1, float val2, float val3, float val4);
+// same result as calling efac_add/efac_sub for each value, but much faster,
+// vectorized if the CPU has AVX2 or AVX-512 (override with EFAC_SIMD=scalar,
+// avx2 or avx512 in the environment)
+void efac_add_array(int reg, const float *vals, size_t cnt);
+void efac_sub_array(int reg, const float *vals, size_t cnt);
+// efac_add_array using nthreads threads (0: one per CPU), same result
+// for any thread count
+void efac_parallel_add_array(int reg, const float *vals, size_t cnt,
+                             int nthreads);
+// correctly rounded sum of an array, the same as efac_add_array into a
+// cleared register and efac_read_round_nearest. Blocks are summed in double
+// with an error bound, the exact path is only taken if that bound cannot
+// decide the rounding.
+float efac_sum_adaptive(const float *vals, size_t cnt);
+// exact integer and fixed-point (val * 2^-scale_bits) input, scale_bits
+// from EFAC_FIXED_MIN to EFAC_FIXED_MAX, others set the overflow flag.
+// The arrays are summed in 128 bit first, so they are much faster.
+void efac_add_int64(int reg, int64_t val);
+void efac_add_fixed(int reg, int64_t val, int scale_bits);
+void efac_add_int64_array(int reg, const int64_t *vals, size_t cnt);
+void efac_add_fixed_array(int reg, const int64_t *vals, size_t cnt,
+                          int scale_bits);
+// add the exact dot product, no rounding of the individual products
+void efac_dot(int reg, const float *a, const float *b, size_t cnt);
+void efac_dot_strided(int reg, const float *a, ptrdiff_t inca,
+                      const float *b, ptrdiff_t incb, size_t cnt);
+
+// accumulators in a named shared memory region for sums across processes.
+// efac_shm_open creates the region with accs accumulators for up to shards
+// writing processes, or attaches to an existing one with the same
+// geometry (0, 0 attaches to any). Returns NULL on error.
+typedef struct efac_shm efac_shm_t;
+efac_shm_t *efac_shm_open(const char *name, int accs, int shards);
+// releases the shard claimed through this handle, the region stays
+void efac_shm_close(efac_shm_t *shm);
+// returns 1 on success; attached processes keep their mapping
+int efac_shm_unlink(const char *name);
+// take a free shard for the calling process, call it after fork.
+// Shards of dead processes are taken over if no other is free.
+// Returns the shard number, -1 if all are taken. The values added
+// to a shard stay in the sums after it is released.
+int efac_shm_claim(efac_shm_t *shm);
+void efac_shm_release(efac_shm_t *shm);
+// add to accumulator acc in the claimed shard, 0 without one
+int efac_shm_add(efac_shm_t *shm, int acc, float val);
+int efac_shm_sub(efac_shm_t *shm, int acc, float val);
+int efac_shm_add_array(efac_shm_t *shm, int acc, const float *vals,
+                       size_t cnt);
+int efac_shm_sub_array(efac_shm_t *shm, int acc, const float *vals,
+                       size_t cnt);
+// exact sum of accumulator acc over all shards into register reg, without
+// locking out the writers. Each shard is taken at some point during the
+// call, so additions made meanwhile may or may not be included. Returns
+// 0 if a shard was left out because its process is in the middle of an
+// update that did not finish within a second, or if a process ever died
+// in the middle of an update of acc, whose earlier additions are lost.
+int efac_shm_read(efac_shm_t *shm, int acc, int reg);
+
+// exact sums for any number of 64 bit keys (SUM ... GROUP BY key), about
+// 48 bytes per key plus the hash index; keys whose values span more than
+// about 2^64 get an extra 128 byte register. expected is a size hint.
+typedef struct efac_group efac_group_t;
+efac_group_t *efac_group_create(size_t expected);
+void efac_group_free(efac_group_t *g);
+// add vals[i] to the sum of keys[i], returns 0 if out of memory
+int efac_group_add(efac_group_t *g, const uint64_t *keys, const float *vals,
+                   size_t cnt);
+int efac_group_sub(efac_group_t *g, const uint64_t *keys, const float *vals,
+                   size_t cnt);
+size_t efac_group_count(const efac_group_t *g);
+// all keys in insertion order and their sums rounded to nearest, the
+// arrays need efac_group_count entries
+void efac_group_read(const efac_group_t *g, uint64_t *keys, float *sums);
+// sum of one key in the 5 rounding modes like efac_read_all, 0 if unknown
+int efac_group_get(const efac_group_t *g, uint64_t key, float out[5]);
+// memory currently allocated
+size_t efac_group_bytes(const efac_group_t *g);
+
+// exact sums of decimal columns of delimited text like CSV or TSV.
+// cols are the 0-based numbers of the fields to sum, they are parsed
+// correctly rounded to double. Quoted fields may contain the delimiter.
+typedef struct efac_csv efac_csv_t;
+efac_csv_t *efac_csv_create(char delim, const int *cols, int ncols);
+void efac_csv_free(efac_csv_t *csv);
+// parse the complete lines in buf, returns the number of bytes used.
+// With last set the rest is parsed as the final line as well.
+size_t efac_csv_parse(efac_csv_t *csv, const char *buf, size_t len,
+                      int last);
+// add the sums of src, created with the same columns, to dst
+void efac_csv_merge(efac_csv_t *dst, efac_csv_t *src);
+// sum of cols[i] in the 5 rounding modes like efac_read_all
+void efac_csv_read(efac_csv_t *csv, int i, double out[5]);
+// numbers added to cols[i], and fields that were neither empty nor numbers
+size_t efac_csv_count(const efac_csv_t *csv, int i);
+size_t efac_csv_invalid(const efac_csv_t *csv, int i);
+
+// exact count, sum and sum of squares of floats, each square is exact in
+// 48 bits. Mean and variance are calculated from the exact sums and rounded
+// to double once, so they do not depend on the order of the values or on
+// how they were split up and merged. Like the register reads, they are
+// Inf after an Inf or NaN value.
+typedef struct efac_moments efac_moments_t;
+efac_moments_t *efac_moments_create(void);
+void efac_moments_free(efac_moments_t *m);
+void efac_moments_clear(efac_moments_t *m);
+void efac_moments_add(efac_moments_t *m, float val);
+void efac_moments_add_array(efac_moments_t *m, const float *vals, size_t cnt);
+void efac_moments_merge(efac_moments_t *dst, efac_moments_t *src);
+uint64_t efac_moments_count(const efac_moments_t *m);
+// correctly rounded to nearest
+double efac_moments_sum(efac_moments_t *m);
+// NaN without values
+double efac_moments_mean(efac_moments_t *m);
+// sum of squared deviations from the mean divided by count - ddof, ddof 0
+// for the population variance, 1 for the sample variance. NaN if count is
+// not above ddof.
+double efac_moments_variance(efac_moments_t *m, unsigned ddof);
+
+// y = b + A x, or b - A x with sub set, for a dense row-major matrix A
+// with rows x cols values and row stride lda, or a sparse one in CSR
+// format with the values of row i at rowptr[i] to rowptr[i + 1] - 1. b
+// may be NULL for zero. Each row is summed exactly and rounded once with
+// mode 0..4 like efac_read_all, so y does not depend on the order of the
+// columns, the value of nthreads or the CPU. nthreads 0 uses one per CPU.
+void efac_gemv(int rows, int cols, const float *a, size_t lda,
+               const float *x, const float *b, int sub, float *y, int mode,
+               int nthreads);
+void efac_spmv(int rows, const size_t *rowptr, const int *colidx,
+               const float *vals, const float *x, const float *b, int sub,
+               float *y, int mode, int nthreads);
+
+// out[i] = in[0] + ... + in[i] rounded with mode 0..4 like efac_read_all.
+// in and out must not overlap. Blocks are summed in parallel, then
+// scanned in parallel starting with the exact sum of the blocks before
+// them, so the result does not depend on nthreads. nthreads 0 uses one
+// per CPU.
+void efac_inclusive_scan(const float *in, float *out, size_t cnt, int mode,
+                         int nthreads);
+
+// exact moving sums over the last len samples of nseries series. Samples
+// are subtracted exactly when they leave the window, so the sums never
+// drift and each sample takes the same time for any len. Inf and NaN
+// samples make the sum Inf while they are in the window.
+typedef struct efac_window efac_window_t;
+efac_window_t *efac_window_create(uint32_t nseries, uint32_t len);
+void efac_window_free(efac_window_t *w);
+// empty the window of series id, 0 if unknown
+int efac_window_reset(efac_window_t *w, uint32_t id);
+// append vals[i] to series ids[i] in order, sums[i] is then the window sum
+// of that series rounded with mode 0..4 like efac_read_all. sums may be
+// NULL. Returns 0 if an id is out of range, its sum is NaN.
+int efac_window_push(efac_window_t *w, const uint32_t *ids, const float *vals,
+                     size_t cnt, int mode, float *sums);
+// current window sum of series id in the 5 rounding modes, 0 if unknown
+int efac_window_get(efac_window_t *w, uint32_t id, float out[5]);
+
+// register for adds from many threads at once without locks. A read sees
+// every add that finished before it started and any subset of the ones
+// running meanwhile, never a partial one. Adds never wait for readers.
+typedef struct efac_atomic efac_atomic_t;
+efac_atomic_t *efac_atomic_create(void);
+void efac_atomic_free(efac_atomic_t *a);
+void efac_atomic_add(efac_atomic_t *a, float val);
+void efac_atomic_sub(efac_atomic_t *a, float val);
+// a read running meanwhile may see some of the values, but none partially
+void efac_atomic_add_array(efac_atomic_t *a, const float *vals, size_t cnt);
+// copy the current value to register reg
+void efac_atomic_read(efac_atomic_t *a, int reg);
+
+// counters of the software engine for finding slow inputs, only
+// counted if libsoftefac.c is built with -DEFAC_STATS. efac_clear resets
+// them, merges (parallel adds, shared memory reads) add them up.
+#define EFAC_STATS_CARRY_BINS 6
+struct efac_stats {
+  // values added, subtracted ones included
+  uint64_t adds;
+  uint64_t subs;
+  // carries and borrows past the blocks a value is added to, the blocks
+  // they went through in total and at most
+  uint64_t carries;
+  uint64_t carry_blocks;
+  uint64_t carry_max;
+  // carries through 1, 2, 3-4, 5-8, 9-16 and more blocks
+  uint64_t carry_len[EFAC_STATS_CARRY_BINS];
+  // blocks that became or stopped being sign extension only (allmask)
+  uint64_t transitions;
+  // Inf/NaN inputs and carries out of the top, once per array chunk
+  uint64_t overflows;
+  // array bins and deferred carries added to the blocks
+  uint64_t folds;
+  // reads per rounding mode, indexed like efac_read_all, and those
+  // that had to scan the blocks instead of using the read cache
+  uint64_t reads[5];
+  uint64_t read_scans;
+};
+// returns 0 and all zeros if the counters are compiled out
+int efac_get_stats(int reg, struct efac_stats *stats);
+void efac_print_stats(FILE *f, int reg);
 
-// NOTE: rounding is probably broken for denormals
 float efac_read(int reg);
 float efac_read_round_zero(int reg);
 float efac_read_round_inf(int reg);
 float efac_read_round_ninf(int reg);
 float efac_read_round_pinf(int reg);
 float efac_read_round_nearest(int reg);
+// all rounding modes from one scan of the register, indexed like the
+// device read addresses: zero, inf, ninf, pinf, nearest
+void efac_read_all(int reg, float out[5]);
+// enclosing interval, rounded towards -infinity and +infinity
+void efac_read_interval(int reg, float *lo, float *hi);
+
+// register value * 2^scale_bits rounded towards -infinity, returns 0 if
+// it fits into val, 1 if not (val gets the low 64 bits) or on overflow
+int efac_read_int64(int reg, int64_t *val);
+int efac_read_fixed(int reg, int scale_bits, int64_t *val);
+
+// compact exact registers for half (IEEE binary16) and bfloat16 values,
+// one cache line each and separate from the numbered registers. Values
+// are passed as bit patterns, the arrays use F16C and AVX2 if available.
+#define EFAC_REG16_LIMBS 5
+typedef struct {
+  // two's complement, bit 0 of limb 0 is 2^-133
+  uint64_t limb[EFAC_REG16_LIMBS];
+  uint32_t overflow;
+} __attribute__((aligned(64))) efac_reg16_t;
+void efac_reg16_clear(efac_reg16_t *r);
+void efac_reg16_add_half(efac_reg16_t *r, uint16_t val);
+void efac_reg16_add_bf16(efac_reg16_t *r, uint16_t val);
+void efac_reg16_add_half_array(efac_reg16_t *r, const uint16_t *vals,
+                               size_t cnt);
+void efac_reg16_add_bf16_array(efac_reg16_t *r, const uint16_t *vals,
+                               size_t cnt);
+void efac_reg16_merge(efac_reg16_t *dst, const efac_reg16_t *src);
+// rounded to float like efac_read_all, Inf on overflow
+void efac_reg16_read_all(const efac_reg16_t *r, float out[5]);
+float efac_reg16_read_nearest(const efac_reg16_t *r);
+
+// registers covering the double range, separate from the float ones above
+void efac_clear_double(int reg);
+void efac_add_double(int reg, double val);
+void efac_sub_double(int reg, double val);
+// same result as efac_add_double/efac_sub_double for each value
+void efac_add_double_array(int reg, const double *vals, size_t cnt);
+void efac_sub_double_array(int reg, const double *vals, size_t cnt);
+double efac_read_double(int reg);
+double efac_read_double_round_zero(int reg);
+double efac_read_double_round_inf(int reg);
+double efac_read_double_round_ninf(int reg);
+double efac_read_double_round_pinf(int reg);
+double efac_read_double_round_nearest(int reg);
 
 #endif /* LIBSOFTEFAC_H */
@@ -0,0 +1,196 @@
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libsoftefac_int.h"
+
+//! 16 bit steps of the limbs, so that a float shifted into its limb has at
+//! most 40 bits. Limb LIMBS - 1 is at block 20, above the highest float.
+#define LIMBS 42
+//! limbs are carried into the next one beyond this. Adds that find
+//! another carry in progress skip theirs.
+#define CARRYLIMIT (1LL << 60)
+//! beyond this adders wait for the carry in progress and then carry
+//! themselves. Until they are through, up to 2^8 threads per stripe can
+//! add 2^54 each without overflowing the limb.
+#define HARDLIMIT (1LL << 62)
+//! sets of limbs, the threads are spread over them
+#define STRIPES 16
+//! values summed locally by efac_atomic_add_array before the atomic adds,
+//! each of those stays below 2^54
+#define ARRAYCHUNK (1 << 14)
+
+typedef struct {
+  int64_t limb[LIMBS];
+} __attribute__((aligned(64))) stripe_t;
+
+/**
+ * Register for concurrent adds. The value is the sum of all limbs, limb
+ * l counting 2^(16 l + REGEXP). An add is a single atomic add to one
+ * limb, so readers never see part of it. Carries move whole multiples of
+ * 2^16 from a limb to the next one. They take two atomic adds, so seq is
+ * odd while one runs and readers retry. Adders normally skip the carry
+ * then and leave it to a later add, only beyond HARDLIMIT they wait.
+ */
+struct efac_atomic {
+  stripe_t stripes[STRIPES];
+  uint32_t seq;
+  //! set by Inf and NaN
+  uint32_t special;
+};
+
+//! stripe of this thread, -1 until its first add
+static __thread int own_stripe = -1;
+static int next_stripe;
+
+static int64_t *own_limbs(efac_atomic_t *a) {
+  if (own_stripe < 0)
+    own_stripe = __sync_fetch_and_add(&next_stripe, 1) % STRIPES;
+  return a->stripes[own_stripe].limb;
+}
+
+/**
+ * Limb and shifted signed mantissa of a float.
+ * \return 0 for zero, -1 for Inf and NaN
+ */
+static int split(float val, int *limb, int64_t *v) {
+  union {
+    float f;
+    uint32_t i;
+  } u;
+  int32_t sign;
+  int exp, bit;
+  int64_t mant;
+  u.f = val;
+  sign = (int32_t)u.i >> 31;
+  exp = (u.i >> 23) & 0xff;
+  if (exp == 0xff)
+    return -1;
+  mant = (u.i & 0x7fffff) | (exp ? 0x800000 : 0);
+  if (!mant)
+    return 0;
+  // register bit of the lowest mantissa bit, denormals have exponent 1
+  bit = (exp | !exp) - 150 - REGEXP;
+  *limb = bit >> 4;
+  *v = ((mant << (bit & 15)) ^ sign) - sign;
+  return 1;
+}
+
+/**
+ * Carry limb l into the next one, and further up while that is beyond
+ * CARRYLIMIT as well.
+ * \return 0 if another thread is carrying already
+ */
+static int carry(efac_atomic_t *a, int64_t *limbs, int l) {
+  uint32_t seq = __atomic_load_n(&a->seq, __ATOMIC_RELAXED);
+  if ((seq & 1) ||
+      !__atomic_compare_exchange_n(&a->seq, &seq, seq + 1, 0,
+                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    return 0;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  for (; l < LIMBS - 1; l++) {
+    // other threads keep adding, c is moved exactly anyway
+    int64_t c = __atomic_load_n(&limbs[l], __ATOMIC_RELAXED) >> 16;
+    int64_t next;
+    __atomic_fetch_sub(&limbs[l], (int64_t)((uint64_t)c << 16),
+                       __ATOMIC_RELAXED);
+    next = __atomic_add_fetch(&limbs[l + 1], c, __ATOMIC_RELAXED);
+    if (next < CARRYLIMIT && next > -CARRYLIMIT)
+      break;
+  }
+  __atomic_store_n(&a->seq, seq + 2, __ATOMIC_RELEASE);
+  return 1;
+}
+
+static void add_limb(efac_atomic_t *a, int64_t *limbs, int l, int64_t v) {
+  int64_t sum = __atomic_add_fetch(&limbs[l], v, __ATOMIC_RELAXED);
+  while ((sum >= CARRYLIMIT || sum <= -CARRYLIMIT) && !carry(a, limbs, l)) {
+    if (sum < HARDLIMIT && sum > -HARDLIMIT)
+      break;
+    sched_yield();
+    // the other carry might have been this limb
+    sum = __atomic_load_n(&limbs[l], __ATOMIC_RELAXED);
+  }
+}
+
+efac_atomic_t *efac_atomic_create(void) {
+  void *a;
+  if (posix_memalign(&a, 64, sizeof(efac_atomic_t)))
+    return NULL;
+  memset(a, 0, sizeof(efac_atomic_t));
+  return a;
+}
+
+void efac_atomic_free(efac_atomic_t *a) {
+  free(a);
+}
+
+void efac_atomic_add(efac_atomic_t *a, float val) {
+  int64_t v;
+  int l;
+  int res = split(val, &l, &v);
+  if (res < 0)
+    __atomic_store_n(&a->special, 1, __ATOMIC_RELAXED);
+  else if (res)
+    add_limb(a, own_limbs(a), l, v);
+}
+
+void efac_atomic_sub(efac_atomic_t *a, float val) {
+  efac_atomic_add(a, -val);
+}
+
+void efac_atomic_add_array(efac_atomic_t *a, const float *vals, size_t cnt) {
+  int64_t *limbs = own_limbs(a);
+  int64_t sums[LIMBS];
+  size_t i, n;
+  int l;
+  for (; cnt; cnt -= n) {
+    n = cnt < ARRAYCHUNK ? cnt : ARRAYCHUNK;
+    memset(sums, 0, sizeof(sums));
+    for (i = 0; i < n; i++) {
+      int64_t v;
+      int res = split(vals[i], &l, &v);
+      if (res < 0)
+        __atomic_store_n(&a->special, 1, __ATOMIC_RELAXED);
+      else if (res)
+        sums[l] += v;
+    }
+    for (l = 0; l < LIMBS; l++)
+      if (sums[l])
+        add_limb(a, limbs, l, sums[l]);
+    vals += n;
+  }
+}
+
+void efac_atomic_read(efac_atomic_t *a, int reg) {
+  efac_register_t *dst = efac_get_register(reg);
+  int64_t copy[STRIPES][LIMBS];
+  uint32_t seq;
+  int s, l;
+  // copy a state without a carry in progress
+  do {
+    while ((seq = __atomic_load_n(&a->seq, __ATOMIC_ACQUIRE)) & 1)
+      sched_yield();
+    for (s = 0; s < STRIPES; s++)
+      for (l = 0; l < LIMBS; l++)
+        copy[s][l] = __atomic_load_n(&a->stripes[s].limb[l],
+                                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (__atomic_load_n(&a->seq, __ATOMIC_RELAXED) != seq);
+  efac_reg_clear(dst);
+  for (s = 0; s < STRIPES; s++) {
+    for (l = 0; l < LIMBS; l++) {
+      int64_t v = copy[s][l];
+      if (!v)
+        continue;
+      // odd limbs are half a block up
+      if (l & 1) {
+        efac_reg_add_wide(dst, l / 2, (v & 0xffff) << 16);
+        efac_reg_add_wide(dst, l / 2 + 1, v >> 16);
+      } else {
+        efac_reg_add_wide(dst, l / 2, v);
+      }
+    }
+  }
+  if (__atomic_load_n(&a->special, __ATOMIC_RELAXED))
+    efac_reg_add(dst, 1.0f / 0.0f);
+}
@@ -0,0 +1,309 @@
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "libsoftefac_int.h"
+
+//! values of a column collected before adding them as an array
+#define BATCH 256
+//! longer fields are not numbers for strtod either
+#define MAXNUMBER 256
+
+typedef struct {
+  efac_dregister_t reg;
+  size_t count;
+  size_t invalid;
+  int pending;
+  double batch[BATCH];
+} column_t;
+
+struct efac_csv {
+  char delim;
+  int ncols;
+  //! column of each field number below nfields, -1 if not summed
+  int *slot;
+  int nfields;
+  column_t *cols;
+};
+
+//! powers of ten that are exact in double
+static const double pow10tab[23] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#if LDBL_MANT_DIG == 64
+//! powers of ten that are exact in the 64 bit mantissa of long double
+static const long double pow10ltab[28] = {
+  1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L, 1e6L, 1e7L, 1e8L, 1e9L, 1e10L, 1e11L,
+  1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L, 1e19L, 1e20L, 1e21L,
+  1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L
+};
+#endif
+
+/**
+ * Parse a decimal number correctly rounded to double. Up to 19 digits
+ * with a decimal exponent up to 22 take the exact path of Clinger's
+ * algorithm: both the digits (if below 2^53) and the power of ten are
+ * exact doubles, so the single multiplication or division rounds
+ * correctly. With the 64 bit mantissa of x87 long double the same
+ * works for all 19 digit numbers and exponents up to 27, the result
+ * only has to be rounded a second time to double. That is only wrong
+ * if it lies on half an ulp of double, those and anything else,
+ * including inf and nan, go to strtod.
+ * \return 1 if it is a number, 0 if not, -1 if the field is empty
+ */
+static int parse_double(const char *p, const char *end, double *val) {
+  char buf[MAXNUMBER];
+  const char *start;
+  char *stop;
+  uint64_t m = 0;
+  int digits = 0;
+  int seen = 0;
+  int frac = 0;
+  int exp = 0;
+  int neg = 0;
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+    end--;
+  if (p == end)
+    return -1;
+  start = p;
+  if (*p == '-' || *p == '+')
+    neg = *p++ == '-';
+  for (; p < end && (unsigned)(*p - '0') < 10; p++, seen = 1) {
+    // leading zeros do not count towards the 19 digits
+    digits += m || *p != '0';
+    m = m * 10 + (*p - '0');
+  }
+  if (p < end && *p == '.') {
+    for (p++; p < end && (unsigned)(*p - '0') < 10; p++, seen = 1) {
+      digits += m || *p != '0';
+      m = m * 10 + (*p - '0');
+      frac++;
+    }
+  }
+  if (seen && p < end && (*p | 32) == 'e') {
+    int eneg = 0;
+    p++;
+    if (p < end && (*p == '-' || *p == '+'))
+      eneg = *p++ == '-';
+    if (p == end)
+      return 0;
+    for (; p < end && (unsigned)(*p - '0') < 10; p++)
+      if (exp < 10000)
+        exp = exp * 10 + (*p - '0');
+    if (eneg)
+      exp = -exp;
+  }
+  // only inf and nan can start without a digit
+  if (!seen && (p == end || ((*p | 32) != 'i' && (*p | 32) != 'n')))
+    return 0;
+  exp -= frac;
+  if (seen && p == end && digits <= 19 && m <= 1ULL << 53 &&
+      exp >= -22 && exp <= 22) {
+    double v = m;
+    v = exp < 0 ? v / pow10tab[-exp] : v * pow10tab[exp];
+    *val = neg ? -v : v;
+    return 1;
+  }
+#if LDBL_MANT_DIG == 64
+  if (seen && p == end && digits <= 19 && exp >= -27 && exp <= 27) {
+    union {
+      long double l;
+      uint64_t mant;
+    } v;
+    v.l = m;
+    v.l = exp < 0 ? v.l / pow10ltab[-exp] : v.l * pow10ltab[exp];
+    if ((v.mant & 0x7ff) != 0x400) {
+      *val = neg ? -(double)v.l : (double)v.l;
+      return 1;
+    }
+  }
+#endif
+  if (end - start >= MAXNUMBER)
+    return 0;
+  memcpy(buf, start, end - start);
+  buf[end - start] = 0;
+  *val = strtod(buf, &stop);
+  return stop == buf + (end - start) && stop != buf;
+}
+
+/**
+ * Bit i set if p[i] is the delimiter, a line break or a quote, p[0] to
+ * p[63] or up to end.
+ */
+static uint64_t special_mask(const char *p, const char *end, char delim) {
+  uint64_t m = 0;
+  int i;
+  if (end - p >= 64) {
+    __m128i d = _mm_set1_epi8(delim);
+    __m128i nl = _mm_set1_epi8('\n');
+    __m128i q = _mm_set1_epi8('"');
+    for (i = 0; i < 4; i++) {
+      __m128i x = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+      __m128i s = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, d),
+                                            _mm_cmpeq_epi8(x, nl)),
+                               _mm_cmpeq_epi8(x, q));
+      m |= (uint64_t)(uint16_t)_mm_movemask_epi8(s) << (16 * i);
+    }
+    return m;
+  }
+  for (i = 0; p + i < end; i++)
+    if (p[i] == delim || p[i] == '\n' || p[i] == '"')
+      m |= 1ULL << i;
+  return m;
+}
+
+static void flush(column_t *col) {
+  efac_dreg_add_values(&col->reg, col->batch, col->pending, 0);
+  col->pending = 0;
+}
+
+static void add_field(efac_csv_t *csv, int field, const char *p,
+                      const char *end) {
+  column_t *col;
+  double v;
+  int res;
+  if (field >= csv->nfields || csv->slot[field] < 0)
+    return;
+  col = &csv->cols[csv->slot[field]];
+  res = parse_double(p, end, &v);
+  if (!res) {
+    col->invalid++;
+    return;
+  }
+  if (res < 0)
+    return;
+  col->batch[col->pending++] = v;
+  col->count++;
+  if (col->pending == BATCH)
+    flush(col);
+}
+
+efac_csv_t *efac_csv_create(char delim, const int *cols, int ncols) {
+  efac_csv_t *csv = calloc(1, sizeof(*csv));
+  int i;
+  if (!csv)
+    return NULL;
+  csv->delim = delim;
+  csv->ncols = ncols;
+  for (i = 0; i < ncols; i++)
+    if (cols[i] >= csv->nfields)
+      csv->nfields = cols[i] + 1;
+  csv->slot = malloc(csv->nfields * sizeof(*csv->slot));
+  csv->cols = malloc(ncols * sizeof(*csv->cols));
+  if (!csv->slot || !csv->cols || delim == '\n' || delim == '"') {
+    efac_csv_free(csv);
+    return NULL;
+  }
+  for (i = 0; i < csv->nfields; i++)
+    csv->slot[i] = -1;
+  for (i = 0; i < ncols; i++) {
+    if (cols[i] < 0 || csv->slot[cols[i]] >= 0) {
+      efac_csv_free(csv);
+      return NULL;
+    }
+    csv->slot[cols[i]] = i;
+    efac_dreg_clear(&csv->cols[i].reg);
+    csv->cols[i].count = 0;
+    csv->cols[i].invalid = 0;
+    csv->cols[i].pending = 0;
+  }
+  return csv;
+}
+
+void efac_csv_free(efac_csv_t *csv) {
+  free(csv->slot);
+  free(csv->cols);
+  free(csv);
+}
+
+size_t efac_csv_parse(efac_csv_t *csv, const char *buf, size_t len,
+                      int last) {
+  const char *end = buf + len;
+  const char *blk = buf;
+  const char *field = buf;
+  // content of a quoted field, NULL if the current one is not quoted
+  const char *qlo = NULL, *qhi = NULL;
+  uint64_t mask;
+  int f = 0;
+  if (!last) {
+    while (end > buf && end[-1] != '\n')
+      end--;
+    if (end == buf)
+      return 0;
+  }
+  mask = special_mask(blk, end, csv->delim);
+  while (1) {
+    const char *q;
+    while (!mask) {
+      blk += 64;
+      if (blk >= end)
+        goto done;
+      mask = special_mask(blk, end, csv->delim);
+    }
+    q = blk + __builtin_ctzll(mask);
+    mask &= mask - 1;
+    if (*q == '"') {
+      const char *r = q + 1;
+      // quotes only matter at the start of a field
+      if (q != field)
+        continue;
+      // "" is an escaped quote
+      while ((r = memchr(r, '"', end - r)) && r + 1 < end && r[1] == '"')
+        r += 2;
+      if (!r)
+        r = end;
+      qlo = q + 1;
+      qhi = r;
+      if (r == end)
+        break;
+      blk = r + 1;
+      mask = special_mask(blk, end, csv->delim);
+      continue;
+    }
+    if (qlo)
+      add_field(csv, f, qlo, qhi);
+    else
+      add_field(csv, f, field, q);
+    qlo = NULL;
+    f = *q == '\n' ? 0 : f + 1;
+    field = q + 1;
+  }
+done:
+  // last line without a line break
+  if (field < end || qlo) {
+    if (qlo)
+      add_field(csv, f, qlo, qhi);
+    else
+      add_field(csv, f, field, end);
+  }
+  return end - buf;
+}
+
+void efac_csv_merge(efac_csv_t *dst, efac_csv_t *src) {
+  int i;
+  for (i = 0; i < dst->ncols && i < src->ncols; i++) {
+    flush(&src->cols[i]);
+    efac_dreg_merge(&dst->cols[i].reg, &src->cols[i].reg);
+    dst->cols[i].count += src->cols[i].count;
+    dst->cols[i].invalid += src->cols[i].invalid;
+  }
+}
+
+void efac_csv_read(efac_csv_t *csv, int i, double out[5]) {
+  int mode;
+  flush(&csv->cols[i]);
+  for (mode = 0; mode < 5; mode++)
+    out[mode] = efac_dreg_read(&csv->cols[i].reg, mode);
+}
+
+size_t efac_csv_count(const efac_csv_t *csv, int i) {
+  return csv->cols[i].count;
+}
+
+size_t efac_csv_invalid(const efac_csv_t *csv, int i) {
+  return csv->cols[i].invalid;
+}
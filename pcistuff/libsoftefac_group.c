@@ -0,0 +1,301 @@
+#include <stdlib.h>
+#include <string.h>
+#include "libsoftefac_int.h"
+
+//! 64 bit limbs per key, covering HOT - 1 block positions of the values
+#define HOT 4
+//! lowest and highest block a float touches, see efac_add
+#define POSMIN (REGSIZE/2 - 4)
+#define POSMAX (POSMIN + 8)
+//! adds between folds into the spill register, keeps limbs from overflowing
+#define PENDMAX ((1 << 24) - 1)
+//! keys looked up at once, their index entries are prefetched
+#define BATCH 16
+#define NOBASE 0xff
+
+/**
+ * Accumulator of one key. Values that fit into the limbs around the
+ * first value's exponent are added there without carry handling, like
+ * with EFAC_DEFERRED_CARRY. Values outside, Inf and NaN go to a full
+ * register in the spill arena, which most keys never need.
+ */
+typedef struct {
+  uint64_t key;
+  //! limb i is at block base + i, scaled like a 25 bit mantissa
+  int64_t limb[HOT];
+  //! index + 1 of the register in the spill arena, 0 if none
+  uint32_t spill;
+  uint32_t pending : 24;
+  uint32_t base : 8;
+} slot_t;
+
+struct efac_group {
+  //! keys in insertion order
+  slot_t *slots;
+  size_t count, slotcap;
+  efac_register_t *spills;
+  size_t spillcount, spillcap;
+  //! open addressing, slot index + 1 in the low and hash bits in the
+  //! high half, 0 if empty
+  uint64_t *index;
+  //! index size is 1 << (64 - shift)
+  int shift;
+};
+
+static uint64_t hash(uint64_t key) {
+  return key * 0x9e3779b97f4a7c15ULL;
+}
+
+static int grow_index(efac_group_t *g) {
+  int shift = g->shift - 1;
+  size_t size = (size_t)1 << (64 - shift);
+  uint64_t *index = calloc(size, sizeof(*index));
+  size_t i;
+  if (!index)
+    return 0;
+  for (i = 0; i < g->count; i++) {
+    uint64_t h = hash(g->slots[i].key);
+    size_t pos = h >> shift;
+    while (index[pos])
+      pos = (pos + 1) & (size - 1);
+    index[pos] = (i + 1) | (h << 32);
+  }
+  free(g->index);
+  g->index = index;
+  g->shift = shift;
+  return 1;
+}
+
+/**
+ * Make room for cnt more keys and spills more spill registers, so that
+ * nothing is reallocated while a batch holds slot indices.
+ */
+static int reserve(efac_group_t *g, size_t cnt, size_t spills) {
+  if (g->count + cnt > g->slotcap) {
+    size_t cap = g->slotcap * 2 > g->count + cnt ? g->slotcap * 2
+                                                 : g->count + cnt;
+    slot_t *slots = realloc(g->slots, cap * sizeof(*slots));
+    if (!slots)
+      return 0;
+    g->slots = slots;
+    g->slotcap = cap;
+  }
+  if (g->spillcount + spills > g->spillcap) {
+    size_t cap = g->spillcap * 2 > g->spillcount + spills
+                 ? g->spillcap * 2 : g->spillcount + spills;
+    efac_register_t *p = realloc(g->spills, cap * sizeof(*p));
+    if (!p)
+      return 0;
+    g->spills = p;
+    g->spillcap = cap;
+  }
+  // at most half full
+  while ((g->count + cnt) * 2 > (size_t)1 << (64 - g->shift))
+    if (!grow_index(g))
+      return 0;
+  return 1;
+}
+
+static efac_register_t *get_spill(efac_group_t *g, slot_t *slot) {
+  if (!slot->spill) {
+    efac_reg_clear(&g->spills[g->spillcount]);
+    slot->spill = ++g->spillcount;
+  }
+  return &g->spills[slot->spill - 1];
+}
+
+static void fold(efac_group_t *g, slot_t *slot) {
+  efac_register_t *preg = get_spill(g, slot);
+  int i;
+  for (i = 0; i < HOT; i++) {
+    if (slot->limb[i])
+      efac_reg_add_wide(preg, slot->base + i, slot->limb[i]);
+    slot->limb[i] = 0;
+  }
+  slot->pending = 0;
+}
+
+/**
+ * First index position for key hash h that is empty or has the same
+ * hash bits, so that its slot can be prefetched before the key compare.
+ */
+static size_t probe(const efac_group_t *g, uint64_t h) {
+  size_t mask = ((size_t)1 << (64 - g->shift)) - 1;
+  size_t pos = h >> g->shift;
+  while (g->index[pos] && (g->index[pos] >> 32) != (h & 0xffffffff))
+    pos = (pos + 1) & mask;
+  return pos;
+}
+
+//! slot of key, starting the search at index position pos, added if new
+static size_t lookup(efac_group_t *g, uint64_t key, uint64_t h, size_t pos) {
+  size_t mask = ((size_t)1 << (64 - g->shift)) - 1;
+  slot_t *slot;
+  while (g->index[pos]) {
+    uint64_t e = g->index[pos];
+    if ((e >> 32) == (h & 0xffffffff) && g->slots[(uint32_t)e - 1].key == key)
+      return (uint32_t)e - 1;
+    pos = (pos + 1) & mask;
+  }
+  slot = &g->slots[g->count];
+  memset(slot, 0, sizeof(*slot));
+  slot->key = key;
+  slot->base = NOBASE;
+  g->index[pos] = (g->count + 1) | (h << 32);
+  return g->count++;
+}
+
+static void add(efac_group_t *g, slot_t *slot, float val) {
+  union {
+    float f;
+    uint32_t i;
+  } v;
+  int32_t sign;
+  int exp;
+  int pos;
+  int64_t mant;
+  v.f = val;
+  sign = (int32_t)v.i >> 31;
+  exp = (v.i >> 23) & 0xff;
+  if (exp == 0xff) { // Inf/NaN
+    efac_reg_add(get_spill(g, slot), val);
+    return;
+  }
+  mant = (v.i & 0x7fffff) | (exp ? 0x800000 : 0);
+  if (!mant)
+    return;
+  mant = (mant ^ sign) - sign;
+  exp |= !exp;
+  mant <<= (exp & 31) + 1;
+  pos = (exp >> 5) + POSMIN;
+  if (slot->base == NOBASE) {
+    // room for one block position below and above the first value
+    slot->base = pos - 1 < POSMIN ? POSMIN :
+                 pos - 1 > POSMAX + 1 - HOT ? POSMAX + 1 - HOT : pos - 1;
+  }
+  pos -= slot->base;
+  if ((unsigned)pos > HOT - 2) {
+    efac_reg_add(get_spill(g, slot), val);
+    return;
+  }
+  slot->limb[pos] += (uint32_t)mant;
+  slot->limb[pos + 1] += mant >> 32;
+  if (++slot->pending == PENDMAX)
+    fold(g, slot);
+}
+
+efac_group_t *efac_group_create(size_t expected) {
+  efac_group_t *g = calloc(1, sizeof(*g));
+  if (!g)
+    return NULL;
+  g->shift = 64 - 4;
+  g->index = calloc((size_t)1 << (64 - g->shift), sizeof(*g->index));
+  if (!g->index || !reserve(g, expected ? expected : 1, 0)) {
+    efac_group_free(g);
+    return NULL;
+  }
+  return g;
+}
+
+void efac_group_free(efac_group_t *g) {
+  free(g->slots);
+  free(g->spills);
+  free(g->index);
+  free(g);
+}
+
+static int add_values(efac_group_t *g, const uint64_t *keys,
+                      const float *vals, size_t cnt, uint32_t signflip) {
+  uint64_t h[BATCH];
+  size_t pos[BATCH];
+  size_t i, j, n;
+  for (i = 0; i < cnt; i += n) {
+    n = cnt - i < BATCH ? cnt - i : BATCH;
+    // each value needs at most one new slot and one new spill register
+    if (!reserve(g, n, n))
+      return 0;
+    for (j = 0; j < n; j++) {
+      h[j] = hash(keys[i + j]);
+      __builtin_prefetch(&g->index[h[j] >> g->shift]);
+    }
+    for (j = 0; j < n; j++) {
+      pos[j] = probe(g, h[j]);
+      if (g->index[pos[j]])
+        __builtin_prefetch(&g->slots[(uint32_t)g->index[pos[j]] - 1], 1);
+    }
+    for (j = 0; j < n; j++) {
+      union {
+        float f;
+        uint32_t i;
+      } v;
+      v.f = vals[i + j];
+      v.i ^= signflip;
+      add(g, &g->slots[lookup(g, keys[i + j], h[j], pos[j])], v.f);
+    }
+  }
+  return 1;
+}
+
+int efac_group_add(efac_group_t *g, const uint64_t *keys, const float *vals,
+                   size_t cnt) {
+  return add_values(g, keys, vals, cnt, 0);
+}
+
+int efac_group_sub(efac_group_t *g, const uint64_t *keys, const float *vals,
+                   size_t cnt) {
+  return add_values(g, keys, vals, cnt, 0x80000000);
+}
+
+size_t efac_group_count(const efac_group_t *g) {
+  return g->count;
+}
+
+/**
+ * Exact value of a key as a full register
+ */
+static void to_register(const efac_group_t *g, const slot_t *slot,
+                        efac_register_t *preg) {
+  int i;
+  if (slot->spill)
+    *preg = g->spills[slot->spill - 1];
+  else
+    efac_reg_clear(preg);
+  for (i = 0; i < HOT; i++)
+    if (slot->limb[i])
+      efac_reg_add_wide(preg, slot->base + i, slot->limb[i]);
+}
+
+void efac_group_read(const efac_group_t *g, uint64_t *keys, float *sums) {
+  efac_register_t reg;
+  size_t i;
+  for (i = 0; i < g->count; i++) {
+    to_register(g, &g->slots[i], &reg);
+    keys[i] = g->slots[i].key;
+    sums[i] = efac_reg_read(&reg, 4);
+  }
+}
+
+int efac_group_get(const efac_group_t *g, uint64_t key, float out[5]) {
+  efac_register_t reg;
+  uint64_t h = hash(key);
+  size_t mask = ((size_t)1 << (64 - g->shift)) - 1;
+  size_t pos = h >> g->shift;
+  int mode;
+  while (g->index[pos]) {
+    const slot_t *slot = &g->slots[(uint32_t)g->index[pos] - 1];
+    if (slot->key == key) {
+      to_register(g, slot, &reg);
+      for (mode = 0; mode < 5; mode++)
+        out[mode] = efac_reg_read(&reg, mode);
+      return 1;
+    }
+    pos = (pos + 1) & mask;
+  }
+  return 0;
+}
+
+size_t efac_group_bytes(const efac_group_t *g) {
+  return sizeof(*g) + g->slotcap * sizeof(slot_t) +
+         g->spillcap * sizeof(efac_register_t) +
+         ((size_t)1 << (64 - g->shift)) * sizeof(uint64_t);
+}
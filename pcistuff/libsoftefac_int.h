@@ -0,0 +1,104 @@
+#ifndef LIBSOFTEFAC_INT_H
+#define LIBSOFTEFAC_INT_H
+
+/*
+ * Register layout and register-pointer based functions shared between the
+ * parts of the software library. Not for use by applications.
+ */
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "libsoftefac.h"
+
+//! as many as the device has, the emulator backs each of them with one
+#define REGCNT 16
+#define REGSIZE 23
+//! exponent of the lowest bit of block 0
+#define REGEXP (-32 * (REGSIZE/2 - 4) - 151)
+//! double registers use 64 bit blocks, the lowest bit is the smallest
+//! denormal. The highest bit of DBL_MAX is bit 2097 in block 32, its top
+//! 14 bits and block 33 are spare. Those 78 bits take 2^78 adds of
+//! +-DBL_MAX before the register overflows.
+#define DREGSIZE 34
+#define DREGEXP (-1074)
+
+/**
+ * With EFAC_DEFERRED_CARRY, efac_add does not touch the blocks but adds
+ * the 32 bit parts of each value to the 64 bit wide entries instead,
+ * without any carry handling. Those are only added to the blocks
+ * before they could overflow, on read and on save.
+ * Everything that changes the value has to clear cached.
+ */
+typedef struct {
+  uint32_t buffer[REGSIZE];
+  uint32_t allmask;
+  uint32_t allvalue;
+  //! bit i set if cache[i] holds the float read with rounding mode i
+  uint32_t cached;
+  float cache[5];
+#ifdef EFAC_DEFERRED_CARRY
+  //! number of efac_add calls since the last normalize
+  uint32_t pending;
+  int64_t wide[REGSIZE];
+#else
+  uint32_t padding[32-REGSIZE-2-6];
+#endif
+#ifdef EFAC_STATS
+  struct efac_stats stats;
+#endif
+} efac_register_t;
+
+/**
+ * Double register, same scheme with 64 bit blocks so that the
+ * allmask/allvalue bitmaps still fit into one word.
+ */
+typedef struct {
+  uint64_t buffer[DREGSIZE];
+  uint64_t allmask;
+  uint64_t allvalue;
+} efac_dregister_t;
+
+efac_register_t *efac_get_register(int reg);
+void efac_reg_clear(efac_register_t *preg);
+void efac_reg_add(efac_register_t *preg, float val);
+//! like efac_add_array, always uses the binning code
+void efac_reg_add_array(efac_register_t *preg, const float *vals, size_t cnt);
+//! efac_add_array, or efac_sub_array with signflip 0x80000000
+void efac_reg_add_values(efac_register_t *preg, const float *vals,
+                         size_t cnt, uint32_t signflip);
+//! add the value of src to dst
+void efac_reg_merge(efac_register_t *dst, efac_register_t *src);
+//! add the signed v to blocks pos and pos + 1 and carry, pos < REGSIZE - 1
+void efac_reg_add_wide(efac_register_t *preg, int pos, int64_t v);
+//! add the exact squares of the values
+void efac_reg_add_squares(efac_register_t *preg, const float *vals,
+                          size_t cnt);
+//! add the exact products a[i] * b[idx[i]], or a[i] * b[i] with idx NULL,
+//! signflip 0x80000000 subtracts them
+void efac_reg_dot(efac_register_t *preg, const float *a, const float *b,
+                  const int *idx, size_t cnt, uint32_t signflip);
+//! read with rounding mode 0..4 like efac_read_all
+float efac_reg_read(efac_register_t *preg, int mode);
+//! copy the blocks, returns the flags: sign in bit 0, overflow in bit 1
+uint32_t efac_reg_blocks(efac_register_t *preg, uint32_t blocks[REGSIZE]);
+//! magnitude of the value in units of 2^REGEXP, returns 1 if it is
+//! negative, -1 on overflow
+int efac_reg_magnitude(efac_register_t *preg, uint32_t mag[REGSIZE]);
+//! round (mag + sticky) * 2^exp to double with rounding mode 0..4, mag is
+//! unsigned with len 32 bit blocks, lowest first, and sticky stands for
+//! anything below it
+double efac_round_magnitude(const uint32_t *mag, int len, int exp, int neg,
+                            int sticky, int mode);
+
+efac_dregister_t *efac_get_double_register(int reg);
+void efac_dreg_clear(efac_dregister_t *preg);
+void efac_dreg_add(efac_dregister_t *preg, double val);
+//! efac_add_double_array, or efac_sub_double_array with the sign bit
+//! in signflip
+void efac_dreg_add_values(efac_dregister_t *preg, const double *vals,
+                          size_t cnt, uint64_t signflip);
+void efac_dreg_merge(efac_dregister_t *dst, efac_dregister_t *src);
+//! read with rounding mode 0..4 like efac_read_all
+double efac_dreg_read(efac_dregister_t *preg, int mode);
+
+#endif /* LIBSOFTEFAC_INT_H */
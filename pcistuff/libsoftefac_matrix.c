@@ -0,0 +1,133 @@
+#include <pthread.h>
+#include <unistd.h>
+#include "libsoftefac_int.h"
+
+//! rows per work item, each has its own register
+#define ROWBAND 64
+//! columns of a dense band done before moving on to the next rows, the
+//! part of x they use stays in the cache
+#define COLBLOCK 8192
+#define MAXTHREADS 256
+
+typedef struct {
+  int rows;
+  int cols;
+  const float *a;
+  size_t lda;
+  const size_t *rowptr;
+  const int *colidx;
+  const float *x;
+  const float *b;
+  uint32_t signflip;
+  float *y;
+  int mode;
+  //! next band to hand out, shared by all workers
+  int next;
+} job_t;
+
+/**
+ * Dense worker: grab bands of rows until none are left. Rows are
+ * independent, so no results have to be merged.
+ */
+static void *gemv_worker(void *arg) {
+  job_t *job = arg;
+  efac_register_t regs[ROWBAND];
+  while (1) {
+    int start = __sync_fetch_and_add(&job->next, ROWBAND);
+    int n, c, r;
+    if (start >= job->rows)
+      break;
+    n = job->rows - start < ROWBAND ? job->rows - start : ROWBAND;
+    for (r = 0; r < n; r++) {
+      efac_reg_clear(&regs[r]);
+      if (job->b)
+        efac_reg_add(&regs[r], job->b[start + r]);
+    }
+    for (c = 0; c < job->cols; c += COLBLOCK) {
+      int m = job->cols - c < COLBLOCK ? job->cols - c : COLBLOCK;
+      for (r = 0; r < n; r++)
+        efac_reg_dot(&regs[r], job->a + (start + r) * job->lda + c,
+                     job->x + c, NULL, m, job->signflip);
+    }
+    for (r = 0; r < n; r++)
+      job->y[start + r] = efac_reg_read(&regs[r], job->mode);
+  }
+  return NULL;
+}
+
+/**
+ * Sparse worker: like gemv_worker, the x values of a row are picked
+ * by the column indices.
+ */
+static void *spmv_worker(void *arg) {
+  job_t *job = arg;
+  efac_register_t reg;
+  while (1) {
+    int start = __sync_fetch_and_add(&job->next, ROWBAND);
+    int end, r;
+    if (start >= job->rows)
+      break;
+    end = job->rows - start < ROWBAND ? job->rows : start + ROWBAND;
+    for (r = start; r < end; r++) {
+      size_t lo = job->rowptr[r];
+      efac_reg_clear(&reg);
+      if (job->b)
+        efac_reg_add(&reg, job->b[r]);
+      efac_reg_dot(&reg, job->a + lo, job->x, job->colidx + lo,
+                   job->rowptr[r + 1] - lo, job->signflip);
+      job->y[r] = efac_reg_read(&reg, job->mode);
+    }
+  }
+  return NULL;
+}
+
+static void run(job_t *job, void *(*worker)(void *), int nthreads) {
+  pthread_t threads[MAXTHREADS];
+  int i;
+  if (nthreads <= 0)
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads > MAXTHREADS)
+    nthreads = MAXTHREADS;
+  if ((job->rows + ROWBAND - 1) / ROWBAND < nthreads)
+    nthreads = (job->rows + ROWBAND - 1) / ROWBAND;
+  job->next = 0;
+  // the calling thread works as well
+  for (i = 1; i < nthreads; i++)
+    if (pthread_create(&threads[i], NULL, worker, job))
+      break;
+  worker(job);
+  while (--i > 0)
+    pthread_join(threads[i], NULL);
+}
+
+void efac_gemv(int rows, int cols, const float *a, size_t lda,
+               const float *x, const float *b, int sub, float *y, int mode,
+               int nthreads) {
+  job_t job;
+  job.rows = rows;
+  job.cols = cols;
+  job.a = a;
+  job.lda = lda;
+  job.x = x;
+  job.b = b;
+  job.signflip = sub ? 0x80000000 : 0;
+  job.y = y;
+  job.mode = mode;
+  run(&job, gemv_worker, nthreads);
+}
+
+void efac_spmv(int rows, const size_t *rowptr, const int *colidx,
+               const float *vals, const float *x, const float *b, int sub,
+               float *y, int mode, int nthreads) {
+  job_t job;
+  job.rows = rows;
+  job.rowptr = rowptr;
+  job.colidx = colidx;
+  job.a = vals;
+  job.x = x;
+  job.b = b;
+  job.signflip = sub ? 0x80000000 : 0;
+  job.y = y;
+  job.mode = mode;
+  run(&job, spmv_worker, nthreads);
+}
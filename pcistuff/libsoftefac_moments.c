@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <string.h>
+#include "libsoftefac_int.h"
+
+//! values per step of efac_moments_add_array, the squares are added
+//! while they are still in the cache
+#define MOMENTCHUNK 16384
+//! blocks the numerators are shifted up by before dividing, so that the
+//! quotient has more bits than a double even for a 128 bit divisor
+#define EXTRA 6
+//! blocks of the numerators: the square of a register, shifted
+#define NUMSIZE (2 * REGSIZE + EXTRA)
+
+struct efac_moments {
+  efac_register_t sum;
+  efac_register_t sumsq;
+  uint64_t count;
+};
+
+efac_moments_t *efac_moments_create(void) {
+  efac_moments_t *m = malloc(sizeof(*m));
+  if (m)
+    efac_moments_clear(m);
+  return m;
+}
+
+void efac_moments_free(efac_moments_t *m) {
+  free(m);
+}
+
+void efac_moments_clear(efac_moments_t *m) {
+  efac_reg_clear(&m->sum);
+  efac_reg_clear(&m->sumsq);
+  m->count = 0;
+}
+
+void efac_moments_add(efac_moments_t *m, float val) {
+  efac_reg_add(&m->sum, val);
+  efac_reg_add_squares(&m->sumsq, &val, 1);
+  m->count++;
+}
+
+void efac_moments_add_array(efac_moments_t *m, const float *vals,
+                            size_t cnt) {
+  m->count += cnt;
+  while (cnt) {
+    size_t n = cnt < MOMENTCHUNK ? cnt : MOMENTCHUNK;
+    efac_reg_add_values(&m->sum, vals, n, 0);
+    efac_reg_add_squares(&m->sumsq, vals, n);
+    vals += n;
+    cnt -= n;
+  }
+}
+
+void efac_moments_merge(efac_moments_t *dst, efac_moments_t *src) {
+  efac_reg_merge(&dst->sum, &src->sum);
+  efac_reg_merge(&dst->sumsq, &src->sumsq);
+  dst->count += src->count;
+}
+
+uint64_t efac_moments_count(const efac_moments_t *m) {
+  return m->count;
+}
+
+/**
+ * Divide in place.
+ * \return the remainder
+ */
+static uint64_t divide(uint32_t *num, int len, uint64_t div) {
+  unsigned __int128 rem = 0;
+  int i;
+  for (i = len - 1; i >= 0; i--) {
+    rem = rem << 32 | num[i];
+    num[i] = rem / div;
+    rem %= div;
+  }
+  return rem;
+}
+
+/**
+ * Multiply in place, the top blocks must leave room for the product.
+ */
+static void multiply(uint32_t *num, int len, uint64_t f) {
+  unsigned __int128 carry = 0;
+  int i;
+  for (i = 0; i < len; i++) {
+    carry += (unsigned __int128)num[i] * f;
+    num[i] = carry;
+    carry >>= 32;
+  }
+}
+
+/**
+ * out = a^2, out has 2 * len blocks.
+ */
+static void square(const uint32_t *a, int len, uint32_t *out) {
+  int i, j;
+  memset(out, 0, 2 * len * sizeof(*out));
+  for (i = 0; i < len; i++) {
+    uint64_t carry = 0;
+    for (j = 0; j < len; j++) {
+      carry += (uint64_t)a[i] * a[j] + out[i + j];
+      out[i + j] = carry;
+      carry >>= 32;
+    }
+    out[i + len] = carry;
+  }
+}
+
+/**
+ * a -= b, a must not be below b.
+ */
+static void subtract(uint32_t *a, const uint32_t *b, int len) {
+  int64_t borrow = 0;
+  int i;
+  for (i = 0; i < len; i++) {
+    borrow += (int64_t)a[i] - b[i];
+    a[i] = borrow;
+    borrow >>= 32;
+  }
+}
+
+double efac_moments_sum(efac_moments_t *m) {
+  uint32_t mag[REGSIZE];
+  int neg = efac_reg_magnitude(&m->sum, mag);
+  if (neg < 0)
+    return 1.0/0.0;
+  return efac_round_magnitude(mag, REGSIZE, REGEXP, neg, 0, 4);
+}
+
+double efac_moments_mean(efac_moments_t *m) {
+  uint32_t num[REGSIZE + EXTRA] = {0};
+  int neg = efac_reg_magnitude(&m->sum, num + EXTRA);
+  uint64_t rem;
+  if (neg < 0)
+    return 1.0/0.0;
+  if (!m->count)
+    return 0.0/0.0;
+  rem = divide(num, REGSIZE + EXTRA, m->count);
+  return efac_round_magnitude(num, REGSIZE + EXTRA, REGEXP - 32 * EXTRA,
+                              neg, !!rem, 4);
+}
+
+/**
+ * The variance is (count * sumsq - sum^2) / (count * (count - ddof)),
+ * the numerator is calculated exactly in units of 2^(2 * REGEXP).
+ */
+double efac_moments_variance(efac_moments_t *m, unsigned ddof) {
+  uint32_t sum[REGSIZE];
+  uint32_t sumsq[REGSIZE];
+  uint32_t num[NUMSIZE] = {0};
+  uint32_t sq[NUMSIZE] = {0};
+  int shift = -REGEXP % 32;
+  uint64_t rem;
+  int i;
+  if (efac_reg_magnitude(&m->sum, sum) < 0 ||
+      efac_reg_magnitude(&m->sumsq, sumsq) < 0)
+    return 1.0/0.0;
+  if (m->count <= ddof)
+    return 0.0/0.0;
+  // sumsq * 2^-REGEXP, shifted up by EXTRA blocks
+  for (i = 0; i < REGSIZE; i++) {
+    int pos = i + EXTRA - REGEXP / 32;
+    num[pos] |= sumsq[i] << shift;
+    num[pos + 1] = shift ? sumsq[i] >> (32 - shift) : 0;
+  }
+  multiply(num, NUMSIZE, m->count);
+  square(sum, REGSIZE, sq + EXTRA);
+  subtract(num, sq, NUMSIZE);
+  rem = divide(num, NUMSIZE, m->count);
+  rem |= divide(num, NUMSIZE, m->count - ddof);
+  return efac_round_magnitude(num, NUMSIZE, 2 * REGEXP - 32 * EXTRA, 0,
+                              !!rem, 4);
+}
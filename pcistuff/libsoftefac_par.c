@@ -0,0 +1,69 @@
+#include <pthread.h>
+#include <unistd.h>
+#include "libsoftefac_int.h"
+
+//! values per work item, large enough to amortize setting up the bins
+#define CHUNK (1 << 16)
+#define MAXTHREADS 256
+
+typedef struct {
+  const float *vals;
+  size_t cnt;
+  //! next chunk to hand out, shared by all workers
+  size_t next;
+  efac_register_t *dst;
+  pthread_mutex_t lock;
+} job_t;
+
+/**
+ * Worker: grab chunks until none are left, accumulate them into a
+ * private register and merge that into the destination at the end.
+ * All operations are exact, so the order in which chunks and workers
+ * finish does not change the result.
+ */
+static void *worker(void *arg) {
+  job_t *job = arg;
+  efac_register_t reg;
+  efac_reg_clear(&reg);
+  while (1) {
+    size_t start = __sync_fetch_and_add(&job->next, CHUNK);
+    if (start >= job->cnt)
+      break;
+    efac_reg_add_array(&reg, job->vals + start,
+                       job->cnt - start < CHUNK ? job->cnt - start : CHUNK);
+  }
+  pthread_mutex_lock(&job->lock);
+  efac_reg_merge(job->dst, &reg);
+  pthread_mutex_unlock(&job->lock);
+  return NULL;
+}
+
+void efac_parallel_add_array(int reg, const float *vals, size_t cnt,
+                             int nthreads) {
+  pthread_t threads[MAXTHREADS];
+  job_t job;
+  int i;
+  if (nthreads <= 0)
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads > MAXTHREADS)
+    nthreads = MAXTHREADS;
+  if ((cnt + CHUNK - 1) / CHUNK < (size_t)nthreads)
+    nthreads = (cnt + CHUNK - 1) / CHUNK;
+  if (nthreads <= 1) {
+    efac_add_array(reg, vals, cnt);
+    return;
+  }
+  job.vals = vals;
+  job.cnt = cnt;
+  job.next = 0;
+  job.dst = efac_get_register(reg);
+  pthread_mutex_init(&job.lock, NULL);
+  // the calling thread works as well
+  for (i = 1; i < nthreads; i++)
+    if (pthread_create(&threads[i], NULL, worker, &job))
+      break;
+  worker(&job);
+  while (--i > 0)
+    pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&job.lock);
+}
@@ -0,0 +1,168 @@
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "libsoftefac_int.h"
+
+//! values per work item, each gets a register for its total
+#define SCANBLOCK (1 << 16)
+//! values between updates of the exact prefix, which also resets the
+//! error bound of the double prefix
+#define SCANCHUNK 1024
+#define MAXTHREADS 256
+
+typedef struct {
+  const float *in;
+  float *out;
+  size_t cnt;
+  int mode;
+  //! total of each block in the first pass, the prefix before it in the
+  //! second one
+  efac_register_t *blocks;
+  //! next block to hand out, shared by all workers
+  size_t next;
+  int pass;
+} job_t;
+
+/**
+ * Round a double to float with rounding mode 0..4, d must be finite
+ * and below FLT_MAX. The float nearest to d has the sign of d, the other
+ * modes round its magnitude up or down by one unit.
+ */
+static float round_float(double d, int mode) {
+  union {
+    float f;
+    uint32_t i;
+  } r;
+  int away = mode == 1 || (mode == 2 && d < 0) || (mode == 3 && d > 0);
+  r.f = d;
+  if (mode == 4 || r.f == d)
+    return r.f;
+  if (away && fabsf(r.f) < fabs(d))
+    r.i++;
+  if (!away && fabsf(r.f) > fabs(d))
+    r.i--;
+  return r.f;
+}
+
+/**
+ * Inclusive scan of a block, starting with the exact prefix in preg.
+ * The prefix is followed in double with an error bound and each output
+ * is taken from there if both ends of the interval round to the same
+ * float. Otherwise the exact prefix is brought up to that value and
+ * read. On return preg holds the prefix including the block.
+ */
+static void scan_block(efac_register_t *preg, const float *in, float *out,
+                       size_t cnt, int mode) {
+  uint32_t mag[REGSIZE];
+  size_t i, n, done;
+  for (; cnt; cnt -= n) {
+    int neg = efac_reg_magnitude(preg, mag);
+    double sum = neg < 0 ? 1.0 / 0.0 :
+                 efac_round_magnitude(mag, REGSIZE, REGEXP, neg, 0, 4);
+    // half an ulp per rounding, doubled like in efac_sum_adaptive
+    double err = fabs(sum) * DBL_EPSILON;
+    n = cnt < SCANCHUNK ? cnt : SCANCHUNK;
+    for (i = done = 0; i < n; i++) {
+      union {
+        float f;
+        uint32_t i;
+      } lo, hi;
+      double e;
+      sum += in[i];
+      err += fabs(sum) * DBL_EPSILON;
+      // the subtraction and addition below round as well
+      e = err + fabs(sum) * DBL_EPSILON;
+      // Inf and NaN inputs, overflows and zero (its sign depends on the
+      // mode) take the exact path
+      if (fabs(sum) + e < FLT_MAX) {
+        lo.f = round_float(sum - e, mode);
+        hi.f = round_float(sum + e, mode);
+        if (lo.i == hi.i && lo.f) {
+          out[i] = lo.f;
+          continue;
+        }
+      }
+      efac_reg_add_values(preg, in + done, i + 1 - done, 0);
+      out[i] = efac_reg_read(preg, mode);
+      done = i + 1;
+    }
+    if (n > done)
+      efac_reg_add_values(preg, in + done, n - done, 0);
+    in += n;
+    out += n;
+  }
+}
+
+/**
+ * Worker: grab blocks until none are left. The first pass sums the
+ * blocks, the second one scans them starting with their exact prefix.
+ */
+static void *worker(void *arg) {
+  job_t *job = arg;
+  while (1) {
+    size_t b = __sync_fetch_and_add(&job->next, 1);
+    size_t start = b * SCANBLOCK;
+    size_t n;
+    if (start >= job->cnt)
+      break;
+    n = job->cnt - start < SCANBLOCK ? job->cnt - start : SCANBLOCK;
+    if (!job->pass) {
+      efac_reg_clear(&job->blocks[b]);
+      efac_reg_add_values(&job->blocks[b], job->in + start, n, 0);
+    } else {
+      scan_block(&job->blocks[b], job->in + start, job->out + start, n,
+                 job->mode);
+    }
+  }
+  return NULL;
+}
+
+static void run(job_t *job, int nthreads) {
+  pthread_t threads[MAXTHREADS];
+  int i;
+  job->next = 0;
+  // the calling thread works as well
+  for (i = 1; i < nthreads; i++)
+    if (pthread_create(&threads[i], NULL, worker, job))
+      break;
+  worker(job);
+  while (--i > 0)
+    pthread_join(threads[i], NULL);
+}
+
+void efac_inclusive_scan(const float *in, float *out, size_t cnt, int mode,
+                         int nthreads) {
+  efac_register_t prefix, total;
+  size_t nblocks = (cnt + SCANBLOCK - 1) / SCANBLOCK;
+  size_t b;
+  job_t job;
+  if (nthreads <= 0)
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads > MAXTHREADS)
+    nthreads = MAXTHREADS;
+  if (nblocks < (size_t)nthreads)
+    nthreads = nblocks;
+  efac_reg_clear(&prefix);
+  if (nthreads <= 1 ||
+      !(job.blocks = malloc(nblocks * sizeof(*job.blocks)))) {
+    scan_block(&prefix, in, out, cnt, mode);
+    return;
+  }
+  job.in = in;
+  job.out = out;
+  job.cnt = cnt;
+  job.mode = mode;
+  job.pass = 0;
+  run(&job, nthreads);
+  // exact scan of the block totals
+  for (b = 0; b < nblocks; b++) {
+    total = job.blocks[b];
+    job.blocks[b] = prefix;
+    efac_reg_merge(&prefix, &total);
+  }
+  job.pass = 1;
+  run(&job, nthreads);
+  free(job.blocks);
+}
@@ -0,0 +1,299 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libsoftefac_int.h"
+
+//! "EFAC", written by the creator once the region is initialized
+#define SHM_MAGIC 0x43414645
+//! how long efac_shm_open waits for the creator to finish, and
+//! efac_shm_read for a writer in the middle of an update, in ms
+#define SHM_WAIT 1000
+//! yields before efac_shm_read starts sleeping on a busy slot
+#define SHM_SPIN 100
+
+typedef struct {
+  uint32_t magic;
+  //! sizeof(efac_register_t), differs between build variants
+  uint32_t regsize;
+  uint32_t accs;
+  uint32_t shards;
+} shm_header_t;
+
+/**
+ * One accumulator of one shard. Only the process owning the shard
+ * writes it, seq is odd while it does.
+ */
+typedef struct {
+  uint32_t seq;
+  //! set for good once a process died in the middle of an update
+  uint32_t lost;
+  efac_register_t reg;
+} __attribute__((aligned(64))) slot_t;
+
+struct efac_shm {
+  void *base;
+  size_t size;
+  shm_header_t *hdr;
+  //! pid of the process owning each shard, 0 if free
+  pid_t *owner;
+  //! shard after shard, accs slots each
+  slot_t *slots;
+  int shard;
+};
+
+static size_t slots_offset(uint32_t shards) {
+  size_t ofs = sizeof(shm_header_t) + shards * sizeof(pid_t);
+  return (ofs + sizeof(slot_t) - 1) / sizeof(slot_t) * sizeof(slot_t);
+}
+
+static size_t region_size(uint32_t accs, uint32_t shards) {
+  return slots_offset(shards) + (size_t)accs * shards * sizeof(slot_t);
+}
+
+static efac_shm_t *map(int fd, size_t size) {
+  efac_shm_t *shm = malloc(sizeof(*shm));
+  if (!shm)
+    return NULL;
+  shm->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (shm->base == MAP_FAILED) {
+    free(shm);
+    return NULL;
+  }
+  shm->size = size;
+  shm->hdr = shm->base;
+  shm->owner = (pid_t *)(shm->hdr + 1);
+  shm->shard = -1;
+  return shm;
+}
+
+static efac_shm_t *create(int fd, int accs, int shards) {
+  size_t size = region_size(accs, shards);
+  efac_shm_t *shm;
+  int i;
+  if (ftruncate(fd, size) || !(shm = map(fd, size)))
+    return NULL;
+  shm->hdr->regsize = sizeof(efac_register_t);
+  shm->hdr->accs = accs;
+  shm->hdr->shards = shards;
+  shm->slots = (slot_t *)((uint8_t *)shm->base + slots_offset(shards));
+  for (i = 0; i < accs * shards; i++)
+    efac_reg_clear(&shm->slots[i].reg);
+  __atomic_store_n(&shm->hdr->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+  return shm;
+}
+
+static efac_shm_t *attach(int fd, int accs, int shards) {
+  struct stat st;
+  efac_shm_t *shm;
+  shm_header_t *hdr;
+  int i;
+  // the creator might not have sized or initialized the region yet
+  for (i = 0; !fstat(fd, &st) && !st.st_size; i++) {
+    if (i == SHM_WAIT)
+      return NULL;
+    usleep(1000);
+  }
+  if ((size_t)st.st_size < sizeof(shm_header_t) ||
+      !(shm = map(fd, st.st_size)))
+    return NULL;
+  hdr = shm->hdr;
+  for (i = 0; __atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC;
+       i++) {
+    if (i == SHM_WAIT)
+      goto fail;
+    usleep(1000);
+  }
+  if (hdr->regsize != sizeof(efac_register_t) ||
+      (accs && hdr->accs != (uint32_t)accs) ||
+      (shards && hdr->shards != (uint32_t)shards) ||
+      shm->size != region_size(hdr->accs, hdr->shards))
+    goto fail;
+  shm->slots = (slot_t *)((uint8_t *)shm->base + slots_offset(hdr->shards));
+  return shm;
+fail:
+  munmap(shm->base, shm->size);
+  free(shm);
+  return NULL;
+}
+
+efac_shm_t *efac_shm_open(const char *name, int accs, int shards) {
+  efac_shm_t *shm = NULL;
+  int fd;
+  if (accs < 0 || shards < 0 || (!accs != !shards))
+    return NULL;
+  fd = accs ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600) : -1;
+  if (fd >= 0) {
+    if (!(shm = create(fd, accs, shards)))
+      shm_unlink(name);
+  } else if (!accs || errno == EEXIST) {
+    if ((fd = shm_open(name, O_RDWR, 0)) >= 0)
+      shm = attach(fd, accs, shards);
+  }
+  if (fd >= 0)
+    close(fd);
+  return shm;
+}
+
+void efac_shm_close(efac_shm_t *shm) {
+  if (shm->shard >= 0)
+    efac_shm_release(shm);
+  munmap(shm->base, shm->size);
+  free(shm);
+}
+
+int efac_shm_unlink(const char *name) {
+  return !shm_unlink(name);
+}
+
+static int is_dead(pid_t pid) {
+  return pid && kill(pid, 0) && errno == ESRCH;
+}
+
+/**
+ * Take over the shard of a dead process. Its sums stay, but a slot it
+ * was updating when it died holds an undefined value. It is cleared for
+ * the new owner and marked lost, so its sums are reported incomplete
+ * from then on.
+ */
+static void reclaim(efac_shm_t *shm, uint32_t shard) {
+  uint32_t i;
+  for (i = 0; i < shm->hdr->accs; i++) {
+    slot_t *slot = &shm->slots[shard * shm->hdr->accs + i];
+    if (!(slot->seq & 1))
+      continue;
+    __atomic_store_n(&slot->lost, 1, __ATOMIC_RELAXED);
+    efac_reg_clear(&slot->reg);
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+  }
+}
+
+int efac_shm_claim(efac_shm_t *shm) {
+  uint32_t i;
+  if (shm->shard >= 0)
+    return shm->shard;
+  for (i = 0; i < shm->hdr->shards; i++)
+    if (__sync_bool_compare_and_swap(&shm->owner[i], 0, getpid()))
+      return shm->shard = i;
+  for (i = 0; i < shm->hdr->shards; i++) {
+    pid_t pid = __atomic_load_n(&shm->owner[i], __ATOMIC_RELAXED);
+    if (is_dead(pid) &&
+        __sync_bool_compare_and_swap(&shm->owner[i], pid, getpid())) {
+      reclaim(shm, i);
+      return shm->shard = i;
+    }
+  }
+  return -1;
+}
+
+void efac_shm_release(efac_shm_t *shm) {
+  __atomic_store_n(&shm->owner[shm->shard], 0, __ATOMIC_RELEASE);
+  shm->shard = -1;
+}
+
+/**
+ * Start an update of an accumulator in the own shard, readers retry
+ * until the matching end_update.
+ * \return NULL without a claimed shard or for an unknown acc
+ */
+static slot_t *begin_update(efac_shm_t *shm, int acc) {
+  slot_t *slot;
+  if (shm->shard < 0 || acc < 0 || (uint32_t)acc >= shm->hdr->accs)
+    return NULL;
+  slot = &shm->slots[shm->shard * shm->hdr->accs + acc];
+  __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  return slot;
+}
+
+static void end_update(slot_t *slot) {
+  __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+int efac_shm_add(efac_shm_t *shm, int acc, float val) {
+  slot_t *slot = begin_update(shm, acc);
+  if (!slot)
+    return 0;
+  efac_reg_add(&slot->reg, val);
+  end_update(slot);
+  return 1;
+}
+
+int efac_shm_sub(efac_shm_t *shm, int acc, float val) {
+  return efac_shm_add(shm, acc, -val);
+}
+
+int efac_shm_add_array(efac_shm_t *shm, int acc, const float *vals,
+                       size_t cnt) {
+  slot_t *slot = begin_update(shm, acc);
+  if (!slot)
+    return 0;
+  efac_reg_add_values(&slot->reg, vals, cnt, 0);
+  end_update(slot);
+  return 1;
+}
+
+int efac_shm_sub_array(efac_shm_t *shm, int acc, const float *vals,
+                       size_t cnt) {
+  slot_t *slot = begin_update(shm, acc);
+  if (!slot)
+    return 0;
+  efac_reg_add_values(&slot->reg, vals, cnt, 0x80000000);
+  end_update(slot);
+  return 1;
+}
+
+/**
+ * Wait until no update of the slot is in progress.
+ * \return the even sequence number, or 1 if the owner of the shard died
+ *         in the middle of an update or did not finish it in SHM_WAIT ms
+ */
+static uint32_t wait_slot(efac_shm_t *shm, uint32_t shard, slot_t *slot) {
+  uint32_t seq;
+  int i;
+  // the writer might have been preempted in the middle of an update
+  for (i = 0; (seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)) & 1;
+       i++) {
+    if (i < SHM_SPIN) {
+      sched_yield();
+      continue;
+    }
+    if (i == SHM_SPIN + SHM_WAIT ||
+        is_dead(__atomic_load_n(&shm->owner[shard], __ATOMIC_RELAXED)))
+      break;
+    usleep(1000);
+  }
+  return seq;
+}
+
+int efac_shm_read(efac_shm_t *shm, int acc, int reg) {
+  efac_register_t *dst = efac_get_register(reg);
+  efac_register_t copy;
+  uint32_t i, seq;
+  int complete = 1;
+  efac_reg_clear(dst);
+  if (acc < 0 || (uint32_t)acc >= shm->hdr->accs)
+    return 0;
+  for (i = 0; i < shm->hdr->shards; i++) {
+    slot_t *slot = &shm->slots[i * shm->hdr->accs + acc];
+    // copy a state that was not changed while copying it
+    do {
+      seq = wait_slot(shm, i, slot);
+      memcpy(&copy, &slot->reg, sizeof(copy));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (!(seq & 1) &&
+             __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq);
+    if (seq & 1)
+      complete = 0;
+    else
+      efac_reg_merge(dst, &copy);
+    if (__atomic_load_n(&slot->lost, __ATOMIC_RELAXED))
+      complete = 0;
+  }
+  return complete;
+}
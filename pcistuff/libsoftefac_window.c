@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include "libsoftefac_int.h"
+
+//! samples looked up at once, their series are prefetched
+#define BATCH 16
+
+/**
+ * Running sum of one series. Each sample is added when it enters the
+ * window and subtracted exactly when it leaves, so the register never
+ * drifts. Inf and NaN would stick in the register, they are only counted
+ * while they are in the window.
+ */
+typedef struct {
+  efac_register_t reg;
+  //! ring position of the next sample
+  uint32_t head;
+  //! samples in the window, up to the window length
+  uint32_t count;
+  //! Inf and NaN samples in the window
+  uint32_t special;
+} series_t;
+
+struct efac_window {
+  uint32_t nseries;
+  uint32_t len;
+  series_t *series;
+  //! len samples per series
+  float *ring;
+};
+
+static int is_special(float val) {
+  union {
+    float f;
+    uint32_t i;
+  } v;
+  v.f = val;
+  return (v.i & 0x7f800000) == 0x7f800000;
+}
+
+efac_window_t *efac_window_create(uint32_t nseries, uint32_t len) {
+  efac_window_t *w = calloc(1, sizeof(*w));
+  uint32_t i;
+  if (!w)
+    return NULL;
+  w->nseries = nseries;
+  w->len = len;
+  w->series = malloc(nseries * sizeof(*w->series));
+  w->ring = malloc((size_t)nseries * len * sizeof(*w->ring));
+  if (!w->series || !w->ring || !len) {
+    efac_window_free(w);
+    return NULL;
+  }
+  for (i = 0; i < nseries; i++)
+    efac_window_reset(w, i);
+  return w;
+}
+
+void efac_window_free(efac_window_t *w) {
+  free(w->series);
+  free(w->ring);
+  free(w);
+}
+
+int efac_window_reset(efac_window_t *w, uint32_t id) {
+  series_t *s;
+  if (id >= w->nseries)
+    return 0;
+  s = &w->series[id];
+  efac_reg_clear(&s->reg);
+  s->head = 0;
+  s->count = 0;
+  s->special = 0;
+  return 1;
+}
+
+static void push(efac_window_t *w, series_t *s, float *ring, float val) {
+  if (s->count == w->len) {
+    float old = ring[s->head];
+    if (is_special(old))
+      s->special--;
+    else
+      efac_reg_add(&s->reg, -old);
+  } else {
+    s->count++;
+  }
+  ring[s->head] = val;
+  if (++s->head == w->len)
+    s->head = 0;
+  if (is_special(val))
+    s->special++;
+  else
+    efac_reg_add(&s->reg, val);
+}
+
+int efac_window_push(efac_window_t *w, const uint32_t *ids, const float *vals,
+                     size_t cnt, int mode, float *sums) {
+  size_t i, j, n;
+  int ok = 1;
+  for (i = 0; i < cnt; i += n) {
+    n = cnt - i < BATCH ? cnt - i : BATCH;
+    for (j = i; j < i + n; j++) {
+      if (ids[j] >= w->nseries)
+        continue;
+      __builtin_prefetch(&w->series[ids[j]], 1);
+      __builtin_prefetch(&w->ring[(size_t)ids[j] * w->len +
+                                  w->series[ids[j]].head], 1);
+    }
+    for (j = i; j < i + n; j++) {
+      series_t *s;
+      if (ids[j] >= w->nseries) {
+        if (sums)
+          sums[j] = 0.0f / 0.0f;
+        ok = 0;
+        continue;
+      }
+      s = &w->series[ids[j]];
+      push(w, s, w->ring + (size_t)ids[j] * w->len, vals[j]);
+      // Inf like a register read after Inf or NaN
+      if (sums)
+        sums[j] = s->special ? 1.0f / 0.0f : efac_reg_read(&s->reg, mode);
+    }
+  }
+  return ok;
+}
+
+int efac_window_get(efac_window_t *w, uint32_t id, float out[5]) {
+  series_t *s;
+  int mode;
+  if (id >= w->nseries)
+    return 0;
+  s = &w->series[id];
+  for (mode = 0; mode < 5; mode++)
+    out[mode] = s->special ? 1.0f / 0.0f : efac_reg_read(&s->reg, mode);
+  return 1;
+}
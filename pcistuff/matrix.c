@@ -0,0 +1,173 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libsoftefac.h"
+
+//! dense matrix, 64 MB
+#define DENSE 4096
+//! sparse matrix, 128 MB with the column indices
+#define SPROWS (1 << 19)
+#define SPCOLS (1 << 20)
+#define SPNNZ 16
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//! random value with a wide range of magnitudes and both signs
+static float random_value(void) {
+  float v = (float)rand() / RAND_MAX * (1 << (rand() % 20));
+  return rand() & 1 ? -v : v;
+}
+
+static void gemv_float(int rows, int cols, const float *a, const float *x,
+                       float *y) {
+  int i, j;
+  for (i = 0; i < rows; i++) {
+    float s = 0;
+    for (j = 0; j < cols; j++)
+      s += a[(size_t)i * cols + j] * x[j];
+    y[i] = s;
+  }
+}
+
+static void gemv_double(int rows, int cols, const float *a, const float *x,
+                        float *y) {
+  int i, j;
+  for (i = 0; i < rows; i++) {
+    double s = 0;
+    for (j = 0; j < cols; j++)
+      s += (double)a[(size_t)i * cols + j] * x[j];
+    y[i] = s;
+  }
+}
+
+static void spmv_float(int rows, const size_t *rowptr, const int *colidx,
+                       const float *vals, const float *x, float *y) {
+  int i;
+  size_t j;
+  for (i = 0; i < rows; i++) {
+    float s = 0;
+    for (j = rowptr[i]; j < rowptr[i + 1]; j++)
+      s += vals[j] * x[colidx[j]];
+    y[i] = s;
+  }
+}
+
+static void spmv_double(int rows, const size_t *rowptr, const int *colidx,
+                        const float *vals, const float *x, float *y) {
+  int i;
+  size_t j;
+  for (i = 0; i < rows; i++) {
+    double s = 0;
+    for (j = rowptr[i]; j < rowptr[i + 1]; j++)
+      s += (double)vals[j] * x[colidx[j]];
+    y[i] = s;
+  }
+}
+
+//! rows of y that differ from the exact result
+static int differ(const float *y, const float *exact, int rows) {
+  int i, n = 0;
+  for (i = 0; i < rows; i++)
+    n += y[i] != exact[i];
+  return n;
+}
+
+static void report(const char *name, double t, double flops, const float *y,
+                   const float *exact, int rows) {
+  printf("%-16s %8.3f %8.2f %8d\n", name, t * 1e3, flops / t * 1e-9,
+         differ(y, exact, rows));
+}
+
+int main(void) {
+  size_t nnz = (size_t)SPROWS * SPNNZ;
+  float *a = malloc((size_t)DENSE * DENSE * sizeof(*a));
+  float *x = malloc(SPCOLS * sizeof(*x));
+  float *y = malloc(SPROWS * sizeof(*y));
+  float *exact = malloc(SPROWS * sizeof(*exact));
+  size_t *rowptr = malloc((SPROWS + 1) * sizeof(*rowptr));
+  int *colidx = malloc(nnz * sizeof(*colidx));
+  float *vals = malloc(nnz * sizeof(*vals));
+  size_t i;
+  int bad;
+  double t;
+  if (!a || !x || !y || !exact || !rowptr || !colidx || !vals ||
+      !efac_init()) {
+    printf("init failed!\n");
+    return 1;
+  }
+  for (i = 0; i < (size_t)DENSE * DENSE; i++)
+    a[i] = random_value();
+  for (i = 0; i < SPCOLS; i++)
+    x[i] = random_value();
+  // 1 to 2 * SPNNZ - 1 values per row
+  rowptr[0] = 0;
+  for (i = 0; i < SPROWS; i++) {
+    size_t n = 1 + rand() % (2 * SPNNZ - 1);
+    if (rowptr[i] + n > nnz || i == SPROWS - 1)
+      n = nnz - rowptr[i];
+    rowptr[i + 1] = rowptr[i] + n;
+  }
+  for (i = 0; i < nnz; i++) {
+    colidx[i] = rand() % SPCOLS;
+    vals[i] = random_value();
+  }
+
+  printf("gemv %dx%d\n", DENSE, DENSE);
+  printf("%-16s %8s %8s %8s\n", "", "ms", "GFLOP/s", "inexact");
+  t = now();
+  efac_gemv(DENSE, DENSE, a, DENSE, x, NULL, 0, exact, 4, 1);
+  t = now() - t;
+  report("efac 1 thread", t, 2.0 * DENSE * DENSE, exact, exact, DENSE);
+  t = now();
+  efac_gemv(DENSE, DENSE, a, DENSE, x, NULL, 0, y, 4, 0);
+  t = now() - t;
+  report("efac threads", t, 2.0 * DENSE * DENSE, y, exact, DENSE);
+  t = now();
+  gemv_float(DENSE, DENSE, a, x, y);
+  t = now() - t;
+  report("float", t, 2.0 * DENSE * DENSE, y, exact, DENSE);
+  t = now();
+  gemv_double(DENSE, DENSE, a, x, y);
+  t = now() - t;
+  report("double", t, 2.0 * DENSE * DENSE, y, exact, DENSE);
+  // b - A x with b the rounded A x is the rounding error, at most half
+  // an ulp of b
+  efac_gemv(DENSE, DENSE, a, DENSE, x, exact, 1, y, 4, 0);
+  bad = 0;
+  for (i = 0; i < DENSE; i++)
+    bad += fabsf(y[i]) > (nextafterf(fabsf(exact[i]), INFINITY) -
+                          fabsf(exact[i])) / 2;
+  printf("rounding error above half an ulp: %d rows\n\n", bad);
+  printf("spmv %dx%d, %zu values\n", SPROWS, SPCOLS, nnz);
+  printf("%-16s %8s %8s %8s\n", "", "ms", "GFLOP/s", "inexact");
+  t = now();
+  efac_spmv(SPROWS, rowptr, colidx, vals, x, NULL, 0, exact, 4, 1);
+  t = now() - t;
+  report("efac 1 thread", t, 2.0 * nnz, exact, exact, SPROWS);
+  t = now();
+  efac_spmv(SPROWS, rowptr, colidx, vals, x, NULL, 0, y, 4, 0);
+  t = now() - t;
+  report("efac threads", t, 2.0 * nnz, y, exact, SPROWS);
+  t = now();
+  spmv_float(SPROWS, rowptr, colidx, vals, x, y);
+  t = now() - t;
+  report("float", t, 2.0 * nnz, y, exact, SPROWS);
+  t = now();
+  spmv_double(SPROWS, rowptr, colidx, vals, x, y);
+  t = now() - t;
+  report("double", t, 2.0 * nnz, y, exact, SPROWS);
+  free(a);
+  free(x);
+  free(y);
+  free(exact);
+  free(rowptr);
+  free(colidx);
+  free(vals);
+  return 0;
+}
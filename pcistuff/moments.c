@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libsoftefac.h"
+
+#define COUNT 10000000
+#define SHARDS 7
+//! the exact case adds the integers OFFSET to OFFSET + EXACTN - 1
+#define EXACTN (1 << 20)
+#define OFFSET (1 << 23)
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct {
+  double n, mean, m2;
+} welford_t;
+
+static void welford_add(welford_t *w, const float *vals, size_t cnt,
+                        int step) {
+  size_t i;
+  for (i = 0; i < cnt; i++) {
+    double x = vals[step < 0 ? cnt - 1 - i : i];
+    double d = x - w->mean;
+    w->n++;
+    w->mean += d / w->n;
+    w->m2 += d * (x - w->mean);
+  }
+}
+
+//! combine two partial results (Chan et al.)
+static void welford_merge(welford_t *dst, const welford_t *src) {
+  double n = dst->n + src->n;
+  double d = src->mean - dst->mean;
+  dst->m2 += src->m2 + d * d * dst->n * src->n / n;
+  dst->mean += d * src->n / n;
+  dst->n = n;
+}
+
+//! the values in SHARDS parts, last one first, merged into m
+static void add_shards(efac_moments_t *m, efac_moments_t *part,
+                       const float *vals, size_t cnt) {
+  int i;
+  efac_moments_clear(m);
+  for (i = SHARDS - 1; i >= 0; i--) {
+    efac_moments_clear(part);
+    efac_moments_add_array(part, vals + cnt * i / SHARDS,
+                           cnt * (i + 1) / SHARDS - cnt * i / SHARDS);
+    efac_moments_merge(m, part);
+  }
+}
+
+//! 0 if all results of a and b are the same bit for bit
+static int compare(efac_moments_t *a, efac_moments_t *b) {
+  double ra[4] = {efac_moments_sum(a), efac_moments_mean(a),
+                  efac_moments_variance(a, 0), efac_moments_variance(a, 1)};
+  double rb[4] = {efac_moments_sum(b), efac_moments_mean(b),
+                  efac_moments_variance(b, 0), efac_moments_variance(b, 1)};
+  return efac_moments_count(a) != efac_moments_count(b) ||
+         memcmp(ra, rb, sizeof(ra));
+}
+
+/**
+ * Shuffled integers OFFSET .. OFFSET + n - 1, whose population variance
+ * (n^2 - 1) / 12 and mean are exact in double. The sample variance
+ * n (n + 1) / 12 is rounded by the one division.
+ * 
+eturn 0 if the results are exact and the shards agree
+ */
+static int check_exact(efac_moments_t *m, efac_moments_t *part,
+                       efac_moments_t *shards) {
+  static float vals[EXACTN];
+  const double n = EXACTN;
+  int i, bad;
+  for (i = 0; i < EXACTN; i++)
+    vals[i] = OFFSET + i;
+  for (i = EXACTN - 1; i > 0; i--) {
+    int j = rand() % (i + 1);
+    float v = vals[i];
+    vals[i] = vals[j];
+    vals[j] = v;
+  }
+  efac_moments_clear(m);
+  efac_moments_add_array(m, vals, EXACTN);
+  add_shards(shards, part, vals, EXACTN);
+  bad = efac_moments_count(m) != EXACTN ||
+        efac_moments_sum(m) != n * OFFSET + n * (n - 1) / 2 ||
+        efac_moments_mean(m) != OFFSET + (n - 1) / 2 ||
+        efac_moments_variance(m, 0) != (n * n - 1) / 12 ||
+        efac_moments_variance(m, 1) != n * (n + 1) / 12;
+  printf("%-18s %.17g %.17g %s, shards %s\n", "efac integers",
+         efac_moments_mean(m), efac_moments_variance(m, 0),
+         bad ? "WRONG" : "exact",
+         compare(m, shards) ? "MISMATCH" : "identical");
+  return bad || compare(m, shards);
+}
+
+int main(void) {
+  int i, bad;
+  float *vals = malloc(COUNT * sizeof(*vals));
+  efac_moments_t *m, *part, *shards;
+  welford_t w;
+  double t;
+  if (!vals || !efac_init() || !(m = efac_moments_create()) ||
+      !(part = efac_moments_create()) || !(shards = efac_moments_create())) {
+    printf("init failed!\n");
+    return 1;
+  }
+  // large mean, small spread
+  for (i = 0; i < COUNT; i++)
+    vals[i] = 1e4f + (float)rand() / RAND_MAX;
+  printf("%-18s %-24s %-24s %s\n", "", "mean", "variance", "ns/value");
+  w.n = w.mean = w.m2 = 0;
+  t = now();
+  welford_add(&w, vals, COUNT, 1);
+  t = now() - t;
+  printf("%-18s %.17g %.17g %.2f\n", "welford forward", w.mean,
+         w.m2 / w.n, t * 1e9 / COUNT);
+  w.n = w.mean = w.m2 = 0;
+  welford_add(&w, vals, COUNT, -1);
+  printf("%-18s %.17g %.17g\n", "welford backward", w.mean, w.m2 / w.n);
+  w.n = w.mean = w.m2 = 0;
+  for (i = 0; i < SHARDS; i++) {
+    welford_t s = {0, 0, 0};
+    welford_add(&s, vals + (size_t)COUNT * i / SHARDS,
+                (size_t)COUNT * (i + 1) / SHARDS - (size_t)COUNT * i / SHARDS,
+                1);
+    welford_merge(&w, &s);
+  }
+  printf("%-18s %.17g %.17g\n", "welford shards", w.mean, w.m2 / w.n);
+  t = now();
+  efac_moments_add_array(m, vals, COUNT);
+  t = now() - t;
+  printf("%-18s %.17g %.17g %.2f\n", "efac", efac_moments_mean(m),
+         efac_moments_variance(m, 0), t * 1e9 / COUNT);
+  add_shards(shards, part, vals, COUNT);
+  bad = compare(m, shards);
+  printf("%-18s %.17g %.17g %s\n", "efac shards", efac_moments_mean(shards),
+         efac_moments_variance(shards, 0), bad ? "MISMATCH" : "identical");
+  bad |= check_exact(m, part, shards);
+  efac_moments_free(m);
+  efac_moments_free(part);
+  efac_moments_free(shards);
+  free(vals);
+  return bad;
+}
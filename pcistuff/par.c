@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "libsoftefac.h"
+
+#define COUNT 100000000
+//! runs per thread count, the fastest one is reported
+#define REPEAT 3
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+  int i, r, failed = 0;
+  int maxthreads = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+  float *vals = malloc(COUNT * sizeof(*vals));
+  static uint32_t ref[512], buf[512];
+  double t1;
+  if (!vals || !efac_init()) {
+    printf("init failed!\n");
+    return 1;
+  }
+  for (i = 0; i < COUNT; i++)
+    vals[i] = (rand() - RAND_MAX / 2) * (1.0f / (1 + (rand() & 0xffff)));
+  // efac_add_array is the baseline the parallel version has to beat
+  t1 = 1e9;
+  for (r = 0; r < REPEAT; r++) {
+    double t;
+    efac_clear(0);
+    t = now();
+    efac_add_array(0, vals, COUNT);
+    t = now() - t;
+    if (t < t1) t1 = t;
+  }
+  efac_save(0, ref);
+  printf("efac_add_array: %.9e %6.2f GB/s\n", efac_read_round_nearest(0),
+         COUNT * sizeof(*vals) / t1 * 1e-9);
+  // powers of two up to and including maxthreads
+  for (i = 1; ; i *= 2) {
+    double best = 1e9;
+    if (i > maxthreads) i = maxthreads;
+    for (r = 0; r < REPEAT; r++) {
+      double t;
+      efac_clear(0);
+      t = now();
+      efac_parallel_add_array(0, vals, COUNT, i);
+      t = now() - t;
+      if (t < best) best = t;
+    }
+    efac_save(0, buf);
+    printf("threads %3i: %.9e %6.2f GB/s speedup %5.2f efficiency %4.2f "
+           "%s\n", i, efac_read_round_nearest(0),
+           COUNT * sizeof(*vals) / best * 1e-9, t1 / best, t1 / best / i,
+           memcmp(ref, buf, sizeof(ref)) ? "MISMATCH" : "identical");
+    failed |= !!memcmp(ref, buf, sizeof(ref));
+    if (i == maxthreads) break;
+  }
+  return failed;
+}
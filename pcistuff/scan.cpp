@@ -0,0 +1,109 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <execution>
+#include <numeric>
+#include <thread>
+#include <vector>
+extern "C" {
+#include "libsoftefac.h"
+}
+
+#define COUNT 100000000
+
+static double now() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// outputs that are not the correctly rounded prefix
+static size_t differ(const std::vector<float> &out,
+                     const std::vector<float> &exact) {
+  size_t n = 0;
+  for (size_t i = 0; i < out.size(); i++)
+    n += memcmp(&out[i], &exact[i], sizeof(float)) != 0;
+  return n;
+}
+
+// the correctly rounded prefixes from one register add and read per value
+static void reference(const std::vector<float> &vals, std::vector<float> &ref,
+                      int mode) {
+  float o[5];
+  efac_clear(0);
+  for (size_t i = 0; i < vals.size(); i++) {
+    efac_add(0, vals[i]);
+    efac_read_all(0, o);
+    ref[i] = o[mode];
+  }
+}
+
+static void report(const char *name, double t, const std::vector<float> &out,
+                   const std::vector<float> &exact) {
+  printf("%-26s %6.2f ns/elem %10zu inexact\n", name, t / COUNT * 1e9,
+         differ(out, exact));
+}
+
+int main() {
+  std::vector<float> vals(COUNT), exact(COUNT), out(COUNT);
+  std::vector<double> dout(COUNT);
+  double t;
+  int bad = 0;
+  if (!efac_init()) {
+    printf("init failed!\n");
+    return 1;
+  }
+  // running balance: deposits and withdrawals of very different sizes
+  for (auto &v : vals)
+    v = (rand() - RAND_MAX / 2) * (1.0f / (1 + (rand() & 0xffff)));
+
+  t = now();
+  reference(vals, exact, 4);
+  report("efac_add + efac_read", now() - t, exact, exact);
+
+  t = now();
+  efac_inclusive_scan(vals.data(), out.data(), COUNT, 4, 1);
+  report("efac 1 thread", now() - t, out, exact);
+  bad += differ(out, exact) != 0;
+
+  t = now();
+  efac_inclusive_scan(vals.data(), out.data(), COUNT, 4, 0);
+  report("efac threads", now() - t, out, exact);
+  bad += differ(out, exact) != 0;
+
+  t = now();
+  std::inclusive_scan(vals.begin(), vals.end(), out.begin());
+  report("inclusive_scan float", now() - t, out, exact);
+
+  t = now();
+  std::inclusive_scan(std::execution::par, vals.begin(), vals.end(),
+                      out.begin());
+  report("inclusive_scan par float", now() - t, out, exact);
+
+  t = now();
+  std::inclusive_scan(vals.begin(), vals.end(), dout.begin(),
+                      std::plus<double>(), 0.0);
+  t = now() - t;
+  for (size_t i = 0; i < COUNT; i++)
+    out[i] = dout[i];
+  report("inclusive_scan double", t, out, exact);
+
+  t = now();
+  std::inclusive_scan(std::execution::par, vals.begin(), vals.end(),
+                      dout.begin(), std::plus<double>(), 0.0);
+  t = now() - t;
+  for (size_t i = 0; i < COUNT; i++)
+    out[i] = dout[i];
+  report("inclusive_scan par double", t, out, exact);
+
+  // the other rounding modes, with one and all threads
+  for (int m = 0; m < 4; m++) {
+    reference(vals, exact, m);
+    efac_inclusive_scan(vals.data(), out.data(), COUNT, m, 1);
+    bad += differ(out, exact) != 0;
+    efac_inclusive_scan(vals.data(), out.data(), COUNT, m, 0);
+    bad += differ(out, exact) != 0;
+  }
+  printf("%s\n", bad ? "MISMATCH" : "all modes correctly rounded");
+  return bad != 0;
+}
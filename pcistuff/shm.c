@@ -0,0 +1,158 @@
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "libsoftefac.h"
+
+#define COUNT 10000000
+#define WORKERS 4
+//! values per efac_shm_add_array call
+#define CHUNK 4096
+//! reads while adding that are compared with a recomputed sum
+#define MAXCHECKS 32
+
+enum { SUM, HEADS, STARTED, FINISHED, ACCS };
+
+/*
+ * Forked workers add their part of the values into their own shard
+ * while the parent reads the merged sum, the final sums have to match
+ * the ones of a single process exactly. Besides the values and the
+ * negated first value of each chunk, every worker counts the chunks it
+ * started and finished in 16 bits of its own. A read of the sum between
+ * a read of the finished and one of the started counts has to contain
+ * at least the finished and at most the started chunks, and if they are
+ * the same, exactly those.
+ */
+static float *vals;
+
+//! chunk counts of the workers from a counter accumulator
+static int counts(efac_shm_t *shm, int acc, int n[WORKERS]) {
+  int64_t v;
+  int w, ok = efac_shm_read(shm, acc, 2) && !efac_read_int64(2, &v);
+  for (w = 0; w < WORKERS; w++)
+    n[w] = v >> 16 * w & 0xffff;
+  return ok;
+}
+
+//! the first n[w] chunks of each worker into register reg
+static void partial(const int n[WORKERS], int reg) {
+  int i, w;
+  efac_clear(reg);
+  for (w = 0; w < WORKERS; w++) {
+    for (i = w * CHUNK; i < (w + n[w] * WORKERS) * CHUNK && i < COUNT;
+         i += WORKERS * CHUNK)
+      efac_add_array(reg, vals + i, COUNT - i < CHUNK ? COUNT - i : CHUNK);
+  }
+}
+
+static void worker(const char *name, int w) {
+  // attach by name like an unrelated process would
+  efac_shm_t *own = efac_shm_open(name, 0, 0);
+  float step = 1ULL << 16 * w;
+  int i, ok;
+  if (!own || efac_shm_claim(own) < 0)
+    _exit(1);
+  for (i = w * CHUNK, ok = 1; i < COUNT; i += WORKERS * CHUNK) {
+    int n = COUNT - i < CHUNK ? COUNT - i : CHUNK;
+    ok &= efac_shm_add(own, STARTED, step);
+    ok &= efac_shm_add_array(own, SUM, vals + i, n);
+    ok &= efac_shm_sub(own, HEADS, vals[i]);
+    ok &= efac_shm_add(own, FINISHED, step);
+    // let the parent read between the chunks with few CPUs as well
+    sched_yield();
+  }
+  efac_shm_close(own);
+  _exit(!ok);
+}
+
+int main(void) {
+  static uint32_t ref[512], heads[512], buf[512], part[512];
+  int prev[WORKERS] = {0}, checked[WORKERS] = {-1};
+  char name[64];
+  efac_shm_t *shm;
+  int i, w, status;
+  int reads = 0, checks = 0, bad = 0;
+  vals = malloc(COUNT * sizeof(*vals));
+  if (!vals || !efac_init()) {
+    printf("init failed!\n");
+    return 1;
+  }
+  for (i = 0; i < COUNT; i++)
+    vals[i] = (rand() - RAND_MAX / 2) * (1.0f / (1 + (rand() & 0xffff)));
+  efac_add_array(0, vals, COUNT);
+  efac_save(0, ref);
+  efac_clear(0);
+  for (i = 0; i < COUNT; i += CHUNK)
+    efac_sub(0, vals[i]);
+  efac_save(0, heads);
+  snprintf(name, sizeof(name), "/efac_shm_%i", (int)getpid());
+  if (!(shm = efac_shm_open(name, ACCS, WORKERS))) {
+    printf("efac_shm_open failed!\n");
+    return 1;
+  }
+  for (w = 0; w < WORKERS; w++)
+    if (!fork())
+      worker(name, w);
+  for (w = 0; w < WORKERS; ) {
+    int lo[WORKERS], hi[WORKERS];
+    pid_t pid = waitpid(-1, &status, WNOHANG);
+    if (pid > 0) {
+      if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        printf("worker failed\n");
+        bad++;
+      }
+      w++;
+      continue;
+    }
+    reads++;
+    if (!counts(shm, FINISHED, lo) || !efac_shm_read(shm, SUM, 1) ||
+        !counts(shm, STARTED, hi)) {
+      printf("read %i incomplete\n", reads);
+      bad++;
+      continue;
+    }
+    for (i = 0; i < WORKERS; i++) {
+      if (lo[i] < prev[i] || lo[i] > hi[i]) {
+        printf("read %i: worker %i finished %i chunks after %i, started "
+               "%i\n", reads, i, lo[i], prev[i], hi[i]);
+        bad++;
+      }
+      prev[i] = lo[i];
+    }
+    // without a chunk in progress the sum is known exactly
+    if (!memcmp(lo, hi, sizeof(lo)) && memcmp(lo, checked, sizeof(lo)) &&
+        checks < MAXCHECKS) {
+      memcpy(checked, lo, sizeof(lo));
+      efac_save(1, buf);
+      partial(lo, 0);
+      efac_save(0, part);
+      if (memcmp(part, buf, sizeof(buf))) {
+        printf("read %i differs from its chunks\n", reads);
+        bad++;
+      }
+      checks++;
+    }
+  }
+  if (!efac_shm_read(shm, SUM, 1)) {
+    printf("final read incomplete\n");
+    bad++;
+  }
+  efac_save(1, buf);
+  printf("%i reads while adding, %i checked, sum %.9e %s, ", reads, checks,
+         efac_read_round_nearest(1),
+         memcmp(ref, buf, sizeof(ref)) ? "MISMATCH" : "identical");
+  bad += !!memcmp(ref, buf, sizeof(ref));
+  if (!efac_shm_read(shm, HEADS, 1)) {
+    printf("final read incomplete\n");
+    bad++;
+  }
+  efac_save(1, buf);
+  printf("chunk heads %.9e %s\n", efac_read_round_nearest(1),
+         memcmp(heads, buf, sizeof(heads)) ? "MISMATCH" : "identical");
+  bad += !!memcmp(heads, buf, sizeof(heads));
+  efac_shm_close(shm);
+  efac_shm_unlink(name);
+  return bad != 0;
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libsoftefac.h"
+
+#define COUNT 1000003
+
+/*
+ * Add the same values with every EFAC_SIMD kernel and compare the saved
+ * registers bit by bit with per value efac_add. Kernels the CPU does not
+ * support fall back to a slower one, which is checked then instead.
+ */
+static const char *const kernels[] = {"scalar", "avx2", "avx512"};
+//! lengths around the vector widths, for the tails
+static const int lengths[] = {1, 7, 8, 9, 15, 16, 17, 31, 33, 63, 65, 1000,
+                              COUNT};
+
+static float bits(uint32_t i) {
+  union {
+    uint32_t i;
+    float f;
+  } v;
+  v.i = i;
+  return v.f;
+}
+
+static uint32_t rand32(void) {
+  return (uint32_t)rand() << 16 ^ rand();
+}
+
+static int run(const char *name, const float *vals) {
+  static uint32_t ref[512], buf[512];
+  int bad = 0;
+  size_t l, k;
+  int i;
+  for (l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+    efac_clear(0);
+    for (i = 0; i < lengths[l]; i++)
+      efac_add(0, vals[i]);
+    efac_save(0, ref);
+    for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+      setenv("EFAC_SIMD", kernels[k], 1);
+      efac_init();
+      efac_add_array(0, vals, lengths[l]);
+      efac_save(0, buf);
+      if (memcmp(ref, buf, sizeof(ref))) {
+        printf("%s: %s differs with %d values\n", name, kernels[k],
+               lengths[l]);
+        bad = 1;
+      }
+    }
+  }
+  printf("%-10s %s\n", name, bad ? "MISMATCH" : "identical");
+  return bad;
+}
+
+int main(void) {
+  float *vals = malloc(COUNT * sizeof(*vals));
+  int bad = 0;
+  int i;
+  if (!vals || !efac_init()) {
+    printf("init failed!\n");
+    return 1;
+  }
+  // all finite bit patterns
+  for (i = 0; i < COUNT; i++) {
+    vals[i] = bits(rand32());
+    if (!(vals[i] - vals[i] == 0))
+      vals[i] = bits(rand32() & 0xbfffffff);
+  }
+  bad |= run("finite", vals);
+  // denormals, +0 and -0 between values of the lowest exponents
+  for (i = 0; i < COUNT; i++) {
+    uint32_t r = rand32();
+    switch (r & 3) {
+    case 0:
+      vals[i] = bits(r & 0x807fffff);
+      break;
+    case 1:
+      vals[i] = bits(r & 0x80000000);
+      break;
+    default:
+      vals[i] = bits(r & 0x81ffffff);
+    }
+  }
+  bad |= run("denormals", vals);
+  // the largest exponents, the sum overflows into the top blocks
+  for (i = 0; i < COUNT; i++)
+    vals[i] = bits((rand32() & 0x807fffff) | 0x7f000000);
+  bad |= run("large", vals);
+  // Inf and NaN at different positions of a vector
+  for (i = 0; i < COUNT; i++) {
+    vals[i] = bits(rand32() & 0xbfffffff);
+    if (!(rand() & 63))
+      vals[i] = bits((rand() & 1) << 31 | 0x7f800000 |
+                     (rand() & 1 ? rand32() & 0x7fffff : 0));
+  }
+  vals[5] = 1.0f / 0.0f;
+  bad |= run("Inf/NaN", vals);
+  free(vals);
+  return bad;
+}
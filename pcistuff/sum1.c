@@ -4,7 +4,9 @@
 #else
 #include "libefac.h"
 #endif
+#ifndef PER_LOOP
 #define PER_LOOP 1
+#endif
 
 static uint32_t flt2int(float x) {
   union {
@@ -17,6 +19,10 @@ static uint32_t flt2int(float x) {
 
 int main(void) {
   int i;
+#if PER_LOOP > 4
+  static float buf[PER_LOOP];
+  int j;
+#endif
   double v1 = 0;
   float v2 = 0;
   float res[3];
@@ -33,6 +39,14 @@ int main(void) {
     efac_add(0, f);
 #elif PER_LOOP == 4
     efac_add4(0, 1.0 / (i + 0), 1.0 / (i + 1), 1.0 / (i + 2), 1.0 / (i + 3));
+#elif PER_LOOP > 4
+    for (j = 0; j < PER_LOOP && i + j < 100000000; j++) {
+      float f = 1.0 / (i + j);
+      v1 += f;
+      v2 += f;
+      buf[j] = f;
+    }
+    efac_add_array(0, buf, j);
 #else
 #error unsupported PER_LOOP value
 #endif
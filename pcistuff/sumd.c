@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <time.h>
+#include "libsoftefac.h"
+
+#define COUNT 100000000
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+  int i;
+  double v1 = 0;
+  double res[5];
+  double t_naive, t_efac;
+  if (!efac_init()) {
+    printf("init failed!\n");
+    return 1;
+  }
+  efac_clear_double(0);
+  t_naive = now();
+  for (i = 1; i < COUNT; i++)
+    v1 += 1.0 / i;
+  t_naive = now() - t_naive;
+  t_efac = now();
+  for (i = 1; i < COUNT; i++)
+    efac_add_double(0, 1.0 / i);
+  t_efac = now() - t_efac;
+  res[0] = efac_read_double_round_nearest(0);
+  res[1] = efac_read_double_round_zero(0);
+  res[2] = efac_read_double_round_inf(0);
+  res[3] = efac_read_double_round_ninf(0);
+  res[4] = efac_read_double_round_pinf(0);
+  printf("naive:   %.18e (%.2f ns/value)\n", v1, t_naive * 1e9 / COUNT);
+  printf("nearest: %.18e (%.2f ns/value)\n", res[0], t_efac * 1e9 / COUNT);
+  printf("zero:    %.18e\n", res[1]);
+  printf("inf:     %.18e\n", res[2]);
+  printf("ninf:    %.18e\n", res[3]);
+  printf("pinf:    %.18e\n", res[4]);
+  printf("naive error: %.3g ulp\n", (v1 - res[0]) / (res[2] - res[1]));
+  return 0;
+}
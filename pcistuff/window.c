@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libsoftefac.h"
+
+#define SERIES 4096
+#define PUSHES 20000000
+//! samples per push call
+#define BATCHSIZE 4096
+//! window sums checked against a fresh register per window length
+#define CHECKS 20000
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Exact window sum of a series in all modes, from the samples in the
+ * ring of the test. Until the ring is full they are at its start.
+ */
+static void exact(const float *ring, uint32_t count, float out[5]) {
+  efac_clear(0);
+  efac_add_array(0, ring, count);
+  efac_read_all(0, out);
+}
+
+int main(void) {
+  static const uint32_t lens[] = {16, 1024, 4096};
+  uint32_t *ids = malloc(PUSHES * sizeof(*ids));
+  float *vals = malloc(PUSHES * sizeof(*vals));
+  float *sums = malloc(PUSHES * sizeof(*sums));
+  float *drift = malloc(PUSHES * sizeof(*drift));
+  size_t i;
+  int l, bad = 0;
+  if (!ids || !vals || !sums || !drift || !efac_init()) {
+    printf("init failed!\n");
+    return 1;
+  }
+  // prices with occasional large spikes
+  for (i = 0; i < PUSHES; i++) {
+    ids[i] = rand() % SERIES;
+    vals[i] = 100.0f + (float)rand() / RAND_MAX;
+    if (!(rand() & 1023))
+      vals[i] *= 1e6f;
+  }
+  printf("%6s %10s %14s %14s %s\n", "len", "ns/sample", "float drifted",
+         "max drift", "window sums");
+  for (l = 0; l < (int)(sizeof(lens) / sizeof(lens[0])); l++) {
+    uint32_t len = lens[l];
+    efac_window_t *w = efac_window_create(SERIES, len);
+    float *ring = calloc((size_t)SERIES * len, sizeof(*ring));
+    float *run = calloc(SERIES, sizeof(*run));
+    uint32_t *head = calloc(SERIES, sizeof(*head));
+    uint32_t *count = calloc(SERIES, sizeof(*count));
+    size_t drifted = 0, wrong = 0;
+    float ref[5], out[5];
+    uint32_t id;
+    float maxdrift = 0;
+    double t;
+    if (!w || !ring || !run || !head || !count) {
+      printf("out of memory\n");
+      return 1;
+    }
+    t = now();
+    for (i = 0; i < PUSHES; i += BATCHSIZE)
+      efac_window_push(w, ids + i, vals + i,
+                       PUSHES - i < BATCHSIZE ? PUSHES - i : BATCHSIZE, 4,
+                       sums + i);
+    t = now() - t;
+    // the usual float moving sum, which keeps the rounding errors
+    for (i = 0; i < PUSHES; i++) {
+      float *slot = &ring[(size_t)ids[i] * len + head[ids[i]]];
+      run[ids[i]] += vals[i] - *slot;
+      *slot = vals[i];
+      head[ids[i]] = (head[ids[i]] + 1) % len;
+      if (count[ids[i]] < len)
+        count[ids[i]]++;
+      if (!(i % (PUSHES / CHECKS))) {
+        exact(ring + (size_t)ids[i] * len, count[ids[i]], ref);
+        wrong += memcmp(&ref[4], &sums[i], sizeof(float)) != 0;
+      }
+      drift[i] = run[ids[i]] - sums[i];
+      drifted += drift[i] != 0;
+      if (drift[i] > maxdrift || -drift[i] > maxdrift)
+        maxdrift = drift[i] < 0 ? -drift[i] : drift[i];
+    }
+    // the final sums of every series in all modes, then empty windows
+    for (id = 0; id < SERIES; id++) {
+      exact(ring + (size_t)id * len, count[id], ref);
+      wrong += !efac_window_get(w, id, out) || memcmp(ref, out, sizeof(ref));
+      wrong += !efac_window_reset(w, id) || !efac_window_get(w, id, out) ||
+               out[0] || out[4];
+    }
+    wrong += efac_window_reset(w, SERIES) || efac_window_get(w, SERIES, out);
+    printf("%6u %10.2f %14zu %14g %s\n", len, t * 1e9 / PUSHES, drifted,
+           maxdrift, wrong ? "MISMATCH" : "exact");
+    bad |= wrong != 0;
+    efac_window_free(w);
+    free(ring);
+    free(run);
+    free(head);
+    free(count);
+  }
+  free(ids);
+  free(vals);
+  free(sums);
+  free(drift);
+  return bad;
+}